@@ -29,7 +29,7 @@ struct Atom{
     return rad;
   }
 
-  const double getCoordinate(const char& dim){
+  const double getCoordinate(const char& dim) const {
     switch(dim){
       case 0: return pos_x;
       case 1: return pos_y;
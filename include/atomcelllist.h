@@ -0,0 +1,73 @@
+#ifndef ATOMCELLLIST_H
+
+#define ATOMCELLLIST_H
+
+#include "vector.h"
+#include <vector>
+#include <array>
+#include <cmath>
+#include <algorithm>
+
+struct Atom;
+// uniform grid of cubic cells over the bounding box of the atom centres. the atoms are sorted by cell and
+// their centres and radii are stored in separate arrays in that order, so the atoms of a cell are contiguous.
+// a query only visits the cells that overlap the cube around the query point that may contain atoms in range.
+// atom radii vary little and atoms are spread evenly in molecules and crystals, so with cells about as large
+// as an atom plus the probe, a query only checks a few atoms per cell
+class AtomCellList{
+  public:
+    AtomCellList() = default;
+    AtomCellList(const std::vector<Atom>&, const double);
+
+    int size() const {return _rad.size();}
+
+    template <class Func>
+    void forEachAtomInRange(const Vector&, const double, Func&&) const;
+
+  private:
+    double _cell_size = 1;
+    std::array<double,3> _origin = {0,0,0};
+    std::array<long,3> _n_cells = {0,0,0};
+    std::vector<unsigned> _cell_start; // index of the first atom of each cell. the last entry is the number of atoms
+    std::array<std::vector<double>,3> _pos;
+    std::vector<double> _rad;
+    double _max_rad = 0;
+
+    long cellCoord(const double, const char) const;
+};
+
+// cell coordinate along one dimension, limited to the grid
+inline long AtomCellList::cellCoord(const double coord, const char dim) const {
+  const long cell = std::floor((coord - _origin[dim]) / _cell_size);
+  return std::clamp(cell, 0l, _n_cells[dim]-1);
+}
+
+// calls func with the position and radius of every atom within range of the point. func returns true to end
+// the search. the atoms are visited cell by cell, which is a different order than the one of the atom tree
+template <class Func>
+void AtomCellList::forEachAtomInRange(const Vector& pos, const double range, Func&& func) const {
+  if (_rad.empty()){return;}
+  const std::array<double,3> point = {pos[0], pos[1], pos[2]};
+  const double reach = range + _max_rad;
+  std::array<long,3> first;
+  std::array<long,3> last;
+  for (char dim = 0; dim < 3; ++dim){
+    first[dim] = cellCoord(point[dim] - reach, dim);
+    last[dim] = cellCoord(point[dim] + reach, dim);
+  }
+  for (long z = first[2]; z <= last[2]; ++z){
+    for (long y = first[1]; y <= last[1]; ++y){
+      const long row = (z * _n_cells[1] + y) * _n_cells[0];
+      for (unsigned i = _cell_start[row + first[0]]; i < _cell_start[row + last[0] + 1]; ++i){
+        const double dx = _pos[0][i] - point[0];
+        const double dy = _pos[1][i] - point[1];
+        const double dz = _pos[2][i] - point[2];
+        const double max_dist = range + _rad[i];
+        if (dx*dx + dy*dy + dz*dz >= max_dist*max_dist){continue;}
+        if (func(Vector(_pos[0][i], _pos[1][i], _pos[2][i]), _rad[i])){return;}
+      }
+    }
+  }
+}
+
+#endif
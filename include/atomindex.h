@@ -0,0 +1,36 @@
+#ifndef ATOMINDEX_H
+
+#define ATOMINDEX_H
+
+#include "flatatomtree.h"
+#include "atomcelllist.h"
+#include <vector>
+
+struct Atom;
+// common interface of the spatial data structures that find the atoms near a voxel. the structure is chosen
+// at runtime, and only the chosen one is built. queries are dispatched once per query, so that the
+// search itself is inlined
+class AtomIndex{
+  public:
+    enum Engine {Tree, CellList};
+
+    AtomIndex() = default;
+    AtomIndex(const std::vector<Atom>&, const Engine, const double);
+
+    Engine getEngine() const {return _engine;}
+
+    // calls func(position, radius) for the atoms that may be within range of the point, until func returns true.
+    // atoms out of range may be passed as well. the order of the atoms depends on the engine
+    template <class Func>
+    void forEachAtomInRange(const Vector& point, const double range, Func&& func) const {
+      if (_engine == CellList){_cell_list.forEachAtomInRange(point, range, func);}
+      else {_tree.forEachAtomInRange(point, range, func);}
+    }
+
+  private:
+    Engine _engine = Tree;
+    FlatAtomTree _tree;
+    AtomCellList _cell_list;
+};
+
+#endif
@@ -3,28 +3,31 @@
 #define ATOMTREE_H
 
 #include <vector>
+#include <array>
 
 struct Atom;
+struct Vector;
 class AtomTree;
 class AtomNode{
   public:
-    AtomNode(int, AtomNode* left_node, AtomNode* right_node);
+    AtomNode(int, AtomNode* left_node, AtomNode* right_node, const std::vector<Atom>&);
     ~AtomNode();
  
     AtomNode* getLeftChild() const;
     AtomNode* getRightChild() const;
-    Atom& getAtom() const;
     int getAtomId() const;
-    void print();
+    double getMaxRad() const;
+    bool isOutOfRange(const Vector&, const double) const;
+    void print(const AtomTree&) const;
 
-    static Atom& getAtom(const int);
-    static void setAtomList(const std::vector<Atom>&);
-    static std::vector<Atom>& getAtomList();
   private:
     AtomNode* _left_child;
     AtomNode* _right_child;
     int _atom_id;
-    static inline std::vector<Atom> s_atom_list;
+    // bounding box of the atom centres and largest atom radius in the subtree of this node
+    std::array<double,3> _box_min;
+    std::array<double,3> _box_max;
+    double _max_rad;
 };
 
 struct Atom;
@@ -34,13 +37,20 @@ class AtomTree{
     AtomTree();
     AtomTree(const std::vector<Atom>& list_of_atoms);
     ~AtomTree();
-    
+    // the tree owns its nodes, copying would lead to nodes being deleted twice
+    AtomTree(const AtomTree&) = delete;
+    AtomTree& operator=(const AtomTree&) = delete;
+
     const AtomNode* getRoot() const;
     const double getMaxRad() const;
+    const Atom& getAtom(const AtomNode*) const;
+    const Atom& getAtom(const int) const;
+    const std::vector<Atom>& getAtomList() const;
     void print() const;
   private:
     AtomNode* _root;
     double _max_rad;
+    std::vector<Atom> _atom_list; // sorted during tree building, nodes refer to atoms by index
     
     AtomNode* buildTree(int, int, char);
   
@@ -0,0 +1,38 @@
+#ifndef CALCMONITOR_H
+
+#define CALCMONITOR_H
+
+#include <atomic>
+#include <string>
+
+// connects a calculation to whoever runs it: the signal that stops the calculation, and the reports of its
+// progress. the space and the voxels only talk to their monitor, never to the controller. the controller is the
+// monitor of the calculations started from the GUI or the command line. only the thread that runs the
+// calculation calls the reports, the workers only read the abort signal
+class CalcMonitor{
+  public:
+    virtual ~CalcMonitor() = default;
+
+    virtual const std::atomic<bool>& getAbortSignal() = 0;
+    virtual void updateStatus(std::string) = 0;
+    virtual void updateProgressBar(const int) = 0;
+    // called regularly during long steps, e.g. to keep the GUI responsive
+    virtual void updateCalculationStatus() = 0;
+};
+
+// a monitor that reports nothing. each instance has its own abort signal, so calculations that run side by side in
+// one process, e.g. for a screening, can be stopped one by one
+class SilentMonitor : public CalcMonitor{
+  public:
+    const std::atomic<bool>& getAbortSignal() override {return _abort;}
+    void updateStatus(std::string) override {}
+    void updateProgressBar(const int) override {}
+    void updateCalculationStatus() override {}
+
+    void abort(){_abort = true;}
+
+  private:
+    std::atomic<bool> _abort{false};
+};
+
+#endif
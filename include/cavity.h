@@ -6,12 +6,17 @@
 #include <algorithm>
 #include <vector>
 #include <string>
+#include <map>
+#include <cstdint>
+
+// the number assigned to core and shell voxels belonging to a cavity. 0: not part of any cavity
+typedef uint32_t CavityID;
 
 struct Cavity{
   Cavity() = default;
-  Cavity(unsigned char id, double core_vol, double shell_vol, std::array<double,3> min_bound, std::array<double,3> max_bound, std::array<unsigned int,3> min_index, std::array<unsigned int,3> max_index) :
+  Cavity(CavityID id, double core_vol, double shell_vol, std::array<double,3> min_bound, std::array<double,3> max_bound, std::array<unsigned int,3> min_index, std::array<unsigned int,3> max_index) :
     id(id), core_vol(core_vol), shell_vol(shell_vol), min_bound(min_bound), max_bound(max_bound), min_index(min_index), max_index(max_index), surf_core(0), surf_shell(0){};
-  unsigned char id; // the number assigned to core and shell voxels belonging to this cavity
+  CavityID id; // the number assigned to core and shell voxels belonging to this cavity
   double core_vol;
   double shell_vol;
   std::array<double,3> min_bound;
@@ -22,6 +27,12 @@ struct Cavity{
   double surf_core;
   double surf_shell;
 
+  // merge tree over the probe radius, only set if it is built
+  double max_probe = 0; // largest probe radius that fits into the cavity
+  std::array<double,3> max_probe_pos = {0,0,0}; // where it fits
+  CavityID merge_id = 0; // the older cavity this one merges into as the probe shrinks. 0: none
+  double merge_probe = 0; // largest probe radius that can pass from this cavity into the older one
+
   double getVolume() const;
   double getSurfCore() const;
   double getSurfShell() const;
@@ -32,4 +43,6 @@ bool compareVolume(const Cavity& a, const Cavity& b);
 
 void inverseSort(std::vector<Cavity>& cavities);
 
+std::map<CavityID,size_t> listCavityNumbers(const std::vector<Cavity>& cavities);
+
 #endif
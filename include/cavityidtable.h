@@ -0,0 +1,49 @@
+#ifndef CAVITYIDTABLE_H
+
+#define CAVITYIDTABLE_H
+
+#include "cavity.h"
+#include <array>
+#include <vector>
+#include <atomic>
+
+// cavity IDs of the leaves of the octree. only the leaves of probe core and probe shell belong to a cavity, so the
+// IDs are kept apart from the voxels, which then only hold their type. a leaf stores its ID in the slot of its
+// first bottom level voxel. the slots are allocated in pages that cover one voxel on the page level each, once a
+// leaf within the page receives an ID. a leaf above the page level uses the first slot of its first page. several
+// threads may set the IDs of different leaves at the same time
+class CavityIDTable{
+  public:
+    CavityIDTable(const std::array<unsigned long,3>&, const int);
+    ~CavityIDTable();
+    CavityIDTable(const CavityIDTable&) = delete;
+    CavityIDTable& operator=(const CavityIDTable&) = delete;
+
+    CavityID get(const std::array<unsigned,3>& index, const int lvl) const {
+      unsigned long slot;
+      const CavityID* page = _pages[locate(index, lvl, slot)].load(std::memory_order_acquire);
+      return page == nullptr? 0 : page[slot];
+    }
+    void set(const std::array<unsigned,3>&, const int, const CavityID);
+
+  private:
+    static inline const int s_page_lvl = 2;
+
+    int _page_lvl;
+    std::array<unsigned long,3> _n_pages;
+    std::vector<std::atomic<CavityID*>> _pages;
+
+    // position of the page and of the slot within the page
+    unsigned long locate(const std::array<unsigned,3>& index, const int lvl, unsigned long& slot) const {
+      const unsigned long mask = (1ul << _page_lvl) - 1;
+      std::array<unsigned long,3> bottom;
+      for (char i = 0; i < 3; ++i){
+        bottom[i] = (unsigned long)index[i] << lvl;
+      }
+      slot = (lvl >= _page_lvl)? 0
+          : (bottom[0] & mask) | ((bottom[1] & mask) << _page_lvl) | ((bottom[2] & mask) << (2*_page_lvl));
+      return ((bottom[2] >> _page_lvl) * _n_pages[1] + (bottom[1] >> _page_lvl)) * _n_pages[0] + (bottom[0] >> _page_lvl);
+    }
+};
+
+#endif
@@ -0,0 +1,56 @@
+#ifndef CAVITYTREE_H
+
+#define CAVITYTREE_H
+
+#include "subvoxelkernel.h"
+#include "cavity.h"
+#include <array>
+#include <vector>
+#include <limits>
+
+class Space;
+class Voxel;
+struct CalcContext;
+
+// merge tree of the cavities over the probe radius. the probe core of a probe with radius r is the space where
+// the clearance, i.e. the distance to the closest atom surface, is at least r. as the probe shrinks, the core
+// grows and cavities merge. the clearance of every bottom level voxel is computed, and the voxels are added in
+// order of decreasing clearance to a union-find over touching voxels. a cavity is born at the largest clearance
+// among its voxels, the largest probe that fits. when two regions containing cavities meet, the younger cavity
+// merges into the older one, at the largest probe radius that can pass from one to the other. the cavities of
+// the calculated probe are already connected, so each of them enters the union-find as a single element, and
+// only the voxels outside of the cavities are sorted.
+// memory: the clearance and cavity take 8 bytes per bottom level voxel, compared to 2 bytes per voxel of the
+// octree, which only splits where needed. the build adds another 28 bytes for each voxel outside of the atoms
+// and cavities: 16 for the sorted order, 4 each for the element index, the union-find and the region cavity.
+// the clearance is released as soon as the voxels are sorted, the rest when the tree is discarded
+class CavityTree{
+  public:
+    CavityTree(Space&);
+
+    void evalTopVxl(const CalcContext&, const std::array<unsigned,3>&, const Vector&);
+    void build(std::vector<Cavity>&);
+
+    // marks the bottom level voxels within the space of the large probe
+    static inline const CavityID s_masked = std::numeric_limits<CavityID>::max();
+
+  private:
+    static inline const double s_candidate_margin = 1e-9;
+
+    double _grid_size;
+    int _max_depth;
+    std::array<double,3> _origin;
+    std::array<unsigned long,3> _n_vxl; // bottom level
+    std::vector<double> _rad_vxl; // per level
+    // bottom level, x runs fastest
+    std::vector<float> _clearance;
+    std::vector<CavityID> _cavity;
+
+    unsigned long offset(const std::array<unsigned,3>& index) const {
+      return (index[2]*_n_vxl[1] + index[1])*_n_vxl[0] + index[0];
+    }
+    void evalVxl(Space&, const std::array<unsigned,3>&, const int, const Vector&, const CandidateAtoms&, const Voxel*, CavityID);
+    void fillVxl(const std::array<unsigned,3>&, const int, const float, const CavityID);
+};
+
+#endif
@@ -6,51 +6,166 @@
 #include <cassert>
 #include <array>
 #include <vector>
+#include <type_traits>
 
-template <class T>
+////////////////////
+// MEMORY LAYOUTS //
+////////////////////
+
+// a layout maps the 3d coordinates of an element to its position in the underlying vector. the layout is
+// chosen as a template parameter of Container3D, so that the mapping can be inlined
+
+// x runs fastest, then y, then z
+class LayoutRowMajor{
+  public:
+    LayoutRowMajor() = default;
+    LayoutRowMajor(const std::array<unsigned long int,3>& n)
+      : _n_x(n[0]), _n_xy(n[0]*n[1]), _size(n[0]*n[1]*n[2]) {}
+
+    unsigned long int size() const {return _size;}
+    unsigned long int index(const unsigned long int x, const unsigned long int y, const unsigned long int z) const {
+      return z * _n_xy + y * _n_x + x;
+    }
+
+  private:
+    unsigned long int _n_x = 0;
+    unsigned long int _n_xy = 0;
+    unsigned long int _size = 0;
+};
+
+// inserts two zero bits between each of the lowest 10 bits
+constexpr unsigned spreadBits(unsigned v){
+  v = (v | (v << 16)) & 0x030000FFu;
+  v = (v | (v <<  8)) & 0x0300F00Fu;
+  v = (v | (v <<  4)) & 0x030C30C3u;
+  v = (v | (v <<  2)) & 0x09249249u;
+  return v;
+}
+
+constexpr std::array<unsigned,1024> makeSpreadTable(){
+  std::array<unsigned,1024> table = {};
+  for (unsigned i = 0; i < table.size(); ++i){
+    table[i] = spreadBits(i);
+  }
+  return table;
+}
+
+// z-order curve. the elements are grouped in cubic tiles whose edge length is the largest power of 2 that
+// divides all dimensions. within a tile, the bits of x, y and z are interleaved, so that the 8 subvoxels of a
+// voxel and the 2x2x2 neighbourhood of most elements are contiguous in memory. the tiles are in row-major order.
+// for the octree grids, a tile contains at least all descendants of one top level voxel
+class LayoutMorton{
+  public:
+    LayoutMorton() = default;
+    LayoutMorton(const std::array<unsigned long int,3>& n){
+      while (_tile_bits < s_max_tile_bits
+          && n[0] % (2ul << _tile_bits) == 0
+          && n[1] % (2ul << _tile_bits) == 0
+          && n[2] % (2ul << _tile_bits) == 0){
+        _tile_bits++;
+      }
+      _tile_mask = (1ul << _tile_bits) - 1;
+      _n_tiles_x = n[0] >> _tile_bits;
+      _n_tiles_xy = _n_tiles_x * (n[1] >> _tile_bits);
+      _size = n[0]*n[1]*n[2];
+    }
+
+    unsigned long int size() const {return _size;}
+    unsigned long int index(const unsigned long int x, const unsigned long int y, const unsigned long int z) const {
+      const unsigned long int tile = (z >> _tile_bits) * _n_tiles_xy + (y >> _tile_bits) * _n_tiles_x + (x >> _tile_bits);
+      const unsigned long int code = s_spread[x & _tile_mask] | (s_spread[y & _tile_mask] << 1) | (s_spread[z & _tile_mask] << 2);
+      return (tile << (3*_tile_bits)) | code;
+    }
+
+  private:
+    static inline const unsigned s_max_tile_bits = 10;
+    // looking up the spread bits is cheaper than computing them for every access
+    static constexpr std::array<unsigned,1024> s_spread = makeSpreadTable();
+
+    unsigned _tile_bits = 0;
+    unsigned long int _tile_mask = 0;
+    unsigned long int _n_tiles_x = 0;
+    unsigned long int _n_tiles_xy = 0;
+    unsigned long int _size = 0;
+};
+
+// bricks of 2^B elements in each direction. within a brick, as well as for the order of the bricks, x runs
+// fastest, then y, then z. the dimensions are padded to a multiple of the brick size
+template <unsigned B = 3>
+class LayoutBricked{
+  public:
+    LayoutBricked() = default;
+    LayoutBricked(const std::array<unsigned long int,3>& n){
+      std::array<unsigned long int,3> n_bricks;
+      for (char i = 0; i < 3; ++i){
+        n_bricks[i] = (n[i] + s_mask) >> B;
+      }
+      _n_bricks_x = n_bricks[0];
+      _n_bricks_xy = n_bricks[0] * n_bricks[1];
+      _size = (_n_bricks_xy * n_bricks[2]) << (3*B);
+    }
+
+    unsigned long int size() const {return _size;}
+    unsigned long int index(const unsigned long int x, const unsigned long int y, const unsigned long int z) const {
+      const unsigned long int brick = (z >> B) * _n_bricks_xy + (y >> B) * _n_bricks_x + (x >> B);
+      return (brick << (3*B)) | ((z & s_mask) << (2*B)) | ((y & s_mask) << B) | (x & s_mask);
+    }
+
+  private:
+    static inline const unsigned long int s_mask = (1ul << B) - 1;
+
+    unsigned long int _n_bricks_x = 0;
+    unsigned long int _n_bricks_xy = 0;
+    unsigned long int _size = 0;
+};
+
+/////////////////
+// CONTAINER3D //
+/////////////////
+
+template <class T, class Layout = LayoutRowMajor>
 class Container3D{
   public:
     // constructors
     Container3D() = default;
 
-    Container3D(const unsigned long int x, const unsigned long int y, const unsigned long int z){
-      _data = std::vector(x*y*z,T());
-      _n_elements[0] = x;
-      _n_elements[1] = y;
-      _n_elements[2] = z;
-    }
+    Container3D(const unsigned long int x, const unsigned long int y, const unsigned long int z)
+      : Container3D(std::array<unsigned long int,3>{x,y,z}){}
 
-    Container3D(const std::array<unsigned long int,3> steps){
-      _data = std::vector(steps[0]*steps[1]*steps[2],T());
+    Container3D(const std::array<unsigned long int,3> steps) : _layout(steps){
+      _data = std::vector(_layout.size(),T());
       _n_elements = steps;
     }
-    
-    Container3D(const std::array<unsigned int,3> steps) 
+
+    Container3D(const std::array<unsigned int,3> steps)
       : Container3D((unsigned long) steps[0], (unsigned long) steps[1], (unsigned long) steps[2]){}
-    
+
     // get element
-    // single integer
-    T& getElement(const unsigned long int i){return _data[i];}
+    // single integer, counted in row-major order independent of the layout
+    T& getElement(const unsigned long int i){
+      if constexpr (std::is_same_v<Layout,LayoutRowMajor>){return _data[i];}
+      else {return getElement(i % _n_elements[0], (i / _n_elements[0]) % _n_elements[1], i / (_n_elements[0] * _n_elements[1]));}
+    }
     // three integers
     T& getElement(const unsigned long int x, const unsigned long int y, const unsigned long int z){
       // check if element is out of bounds
 //      assert(x < _n_elements[0]);
 //      assert(y < _n_elements[1]);
 //      assert(z < _n_elements[2]);
-      return _data[z * _n_elements[0] * _n_elements[1] + y * _n_elements[0] + x];
+      return _data[_layout.index(x,y,z)];
     }
     // arrays
     T& getElement(const std::array<unsigned long int,3> coord){
-      return _data[coord[2] * _n_elements[0] * _n_elements[1] + coord[1] * _n_elements[0] + coord[0]];}
-    
+      return _data[_layout.index(coord[0], coord[1], coord[2])];}
+
     T& getElement(const std::array<unsigned int,3> coord){
-      return _data[coord[2] * _n_elements[0] * _n_elements[1] + coord[1] * _n_elements[0] + coord[0]];}
-    
+      return _data[_layout.index(coord[0], coord[1], coord[2])];}
+
     T& getElement(const std::array<long int,3> coord){
-      return _data[coord[2] * _n_elements[0] * _n_elements[1] + coord[1] * _n_elements[0] + coord[0]];}
-    
+      return _data[_layout.index(coord[0], coord[1], coord[2])];}
+
     T& getElement(const std::array<int,3> coord){
-      return _data[coord[2] * _n_elements[0] * _n_elements[1] + coord[1] * _n_elements[0] + coord[0]];}
+      return _data[_layout.index(coord[0], coord[1], coord[2])];}
     // get boundaries
     template <typename Q = unsigned long>
     std::array<Q,3> getNumElements() const {
@@ -60,8 +175,9 @@ class Container3D{
       }
       return arr;
     }
-  
+
   private:
+    Layout _layout;
     std::vector<T> _data;
     std::array<unsigned long int,3> _n_elements;
 };
@@ -3,14 +3,19 @@
 #define CONTROLLER_H
 
 #include "flags.h"
+#include "calcmonitor.h"
 #include <iostream>
 #include <unordered_map>
+#include <vector>
+#include <atomic>
 #include <wx/wx.h>
 
 struct CalcReportBundle;
+struct CalcOptions;
+struct CalcSwitches;
 class Model;
 class MainFrame;
-class Ctrl{
+class Ctrl : public CalcMonitor{
   public:
     static Ctrl* getInstance();
 
@@ -27,13 +32,13 @@ class Ctrl{
     bool loadElementsFile();
     bool loadAtomFile();
     bool runCalculation();
-    bool runCalculation(const double, const double, const double, const std::string&, const std::string&, const std::string&, const int, const bool, const bool, const bool, const bool, const bool, const bool, const bool, const unsigned);
+    bool runCalculation(const std::vector<double>&, const double, const double, const std::string&, const std::string&, const std::string&, const int, const CalcOptions&, const CalcSwitches&, const unsigned);
     void registerView(MainFrame* inp_gui);
     void clearOutput();
     void notifyUser(std::string);
     void notifyUser(std::wstring);
-    void updateStatus(std::string);
-    void updateProgressBar(const int);
+    void updateStatus(std::string) override;
+    void updateProgressBar(const int) override;
     void prepareOutput(std::string);
     void exportReport();
     void exportReport(std::string);
@@ -45,7 +50,8 @@ class Ctrl{
     bool isCalculationDone();
     void setAbortFlag(const bool=true);
     bool getAbortFlag();
-    void updateCalculationStatus();
+    const std::atomic<bool>& getAbortSignal() override;
+    void updateCalculationStatus() override;
 
     void displayErrorMessage(const int);
     void printErrorMessage(const int);
@@ -56,6 +62,17 @@ class Ctrl{
     bool unittest2Probe();
     bool unittestSurface();
     bool unittestFloodfill();
+    bool unittestLayout();
+    bool unittestAtomTree();
+    bool unittestAtomIndex();
+    bool unittestDistanceTransform();
+    bool unittestCavityTree();
+    bool unittestThreadPool();
+    bool unittestPooledBuffer();
+    bool unittestAtomOrder();
+    bool unittestCalcMonitor();
+    bool unittestModelMonitor();
+    bool unittestSubvoxelKernel();
 
   private:
     // consider making static pointer for model
@@ -64,7 +81,7 @@ class Ctrl{
     static Ctrl* s_instance;
     static MainFrame* s_gui;
 
-    bool _abort_calculation; // variable for main thread to signal stopping the calculation
+    std::atomic<bool> _abort_calculation; // variable for main thread to signal stopping the calculation
     bool _calculation_finished;
     bool _to_gui = true; // determines whether to print to console or to GUI
     bool _quiet = true; // silences all non-result command line outputs
@@ -72,6 +89,7 @@ class Ctrl{
     void displayInput(CalcReportBundle&, const unsigned=mvOUT_ALL);
     void displayResults(CalcReportBundle&, const unsigned=mvOUT_ALL);
     void displayCavityList(CalcReportBundle&, const unsigned=mvOUT_ALL);
+    void displayCavityTree(CalcReportBundle&);
     std::string getErrorMessage(const int);
 
     inline static const std::string s_version = "0.2.0";
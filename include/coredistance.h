@@ -0,0 +1,39 @@
+#ifndef COREDISTANCE_H
+
+#define COREDISTANCE_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <limits>
+
+// squared euclidean distance from every voxel to the closest voxel that contains probe core, for every level
+// of the octree. distances are measured between voxel centres in units of the voxel side length of the level,
+// i.e. in the same units as the shells of the SearchIndex. the map starts out with 0 for voxels containing
+// core and infinity for all others. the distance transform is separable and is applied along x, y and z in
+// turn, where every line of voxels can be transformed independently of the others
+class CoreDistanceMap{
+  public:
+    typedef uint32_t Dist;
+    static inline const Dist s_inf = std::numeric_limits<Dist>::max();
+
+    CoreDistanceMap() = default;
+    CoreDistanceMap(const std::vector<std::array<unsigned long,3>>&);
+
+    bool empty() const {return _dist.empty();}
+    Dist getSquaredDist(const std::array<unsigned,3>& index, const int lvl) const {return _dist[lvl][offset(index, lvl)];}
+    void setCore(const std::array<unsigned,3>& index, const int lvl, const bool core){_dist[lvl][offset(index, lvl)] = core? 0 : s_inf;}
+
+    unsigned long getNumLines(const int, const char) const;
+    void transformLines(const int, const char, const unsigned long, const unsigned long);
+
+  private:
+    std::vector<std::array<unsigned long,3>> _n_vxl; // per level
+    std::vector<std::vector<Dist>> _dist; // per level, x runs fastest
+
+    unsigned long offset(const std::array<unsigned,3>& index, const int lvl) const {
+      return (index[2]*_n_vxl[lvl][1] + index[1])*_n_vxl[lvl][0] + index[0];
+    }
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef COREPYRAMID_H
+
+#define COREPYRAMID_H
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <limits>
+
+class Space;
+class Voxel;
+
+// compact copy of the core bits of all octree levels: one bit per voxel, set if the voxel contains probe core.
+// the bottom level is filled by walking the octree, every other level is the OR of its 8 subvoxels. the shell
+// search reads these bits instead of the voxels themselves, and uses the coarse levels to find a lower bound
+// for the distance to the closest core before probing any neighbour
+class CorePyramid{
+  public:
+    typedef uint64_t Word;
+    static inline const unsigned long s_inf = std::numeric_limits<unsigned long>::max();
+
+    CorePyramid() = default;
+    CorePyramid(Space&, const char);
+
+    bool empty() const {return _bits.empty();}
+    bool hasCore(const std::array<unsigned,3>& index, const int lvl) const {
+      const unsigned long i = offset(index, lvl);
+      return (_bits[lvl][i / s_word_bits] >> (i % s_word_bits)) & 1;
+    }
+    unsigned long lowerBound(const std::array<unsigned,3>&, const int, const unsigned long) const;
+
+  private:
+    static inline const unsigned s_word_bits = 64;
+
+    std::vector<std::array<unsigned long,3>> _n_vxl; // per level
+    std::vector<std::vector<Word>> _bits; // per level, x runs fastest
+
+    unsigned long offset(const std::array<unsigned,3>& index, const int lvl) const {
+      return (index[2]*_n_vxl[lvl][1] + index[1])*_n_vxl[lvl][0] + index[0];
+    }
+    void setFromVoxel(Space&, Voxel&, const std::array<unsigned,3>&, const int, const char);
+    void setBits(const unsigned long, const unsigned long);
+    void poolLevel(const int);
+};
+
+#endif
@@ -0,0 +1,82 @@
+#ifndef FLATATOMTREE_H
+
+#define FLATATOMTREE_H
+
+#include "vector.h"
+#include <vector>
+#include <array>
+#include <cassert>
+
+struct Atom;
+// the same 3-d tree as AtomTree, stored without pointers. the node of the atom range [first,end) is the
+// median first + (end-first)/2, and its children are the ranges [first,median) and [median+1,end). the
+// nodes are therefore simply the atoms in the order of the sorted atom list. the data needed during the
+// search is stored in separate arrays in that order, so that visiting a node only loads a few numbers
+// instead of an Atom object and its child pointers
+class FlatAtomTree{
+  public:
+    FlatAtomTree() = default;
+    FlatAtomTree(const std::vector<Atom>&);
+
+    int size() const {return _rad.size();}
+    Vector getPos(const int node) const {return Vector(_pos[0][node], _pos[1][node], _pos[2][node]);}
+    double getRad(const int node) const {return _rad[node];}
+    double getMaxRad() const {return _rad.empty()? 0 : _max_rad[rootOf(0,size())];}
+    const std::vector<Atom>& getAtomList() const {return _atom_list;}
+
+    template <class Func>
+    void forEachAtomInRange(const Vector&, const double, Func&&) const;
+
+  private:
+    // the stack holds at most one range per level of the tree, plus one. enough for any number of atoms
+    // that can be indexed by int
+    static inline const int s_max_stack = 64;
+
+    std::vector<Atom> _atom_list; // sorted into tree order
+    std::array<std::vector<double>,3> _pos;
+    std::vector<double> _rad;
+    // bounding box of the atom centres and largest atom radius in the subtree of each node
+    std::array<std::vector<double>,3> _box_min;
+    std::array<std::vector<double>,3> _box_max;
+    std::vector<double> _max_rad;
+
+    static int rootOf(const int first, const int end){return first + (end-first)/2;}
+    void fitBounds(const int, const int);
+    bool isOutOfRange(const int, const std::array<double,3>&, const double) const;
+};
+
+// returns true if no atom in the subtree of the node comes closer to the point than the given range
+inline bool FlatAtomTree::isOutOfRange(const int node, const std::array<double,3>& point, const double range) const {
+  double dist_squared = 0;
+  for (char dim = 0; dim < 3; ++dim){
+    double excess = 0;
+    if (point[dim] < _box_min[dim][node]){excess = _box_min[dim][node] - point[dim];}
+    else if (point[dim] > _box_max[dim][node]){excess = point[dim] - _box_max[dim][node];}
+    dist_squared += excess * excess;
+  }
+  const double reach = range + _max_rad[node];
+  return dist_squared > reach * reach;
+}
+
+// calls func for every node, whose subtree may contain an atom within range of the point. the nodes are
+// visited in the same order as a recursive search through AtomTree: node, left subtree, right subtree.
+// func receives the position and radius of the node's atom and returns true to end the search
+template <class Func>
+void FlatAtomTree::forEachAtomInRange(const Vector& pos, const double range, Func&& func) const {
+  const std::array<double,3> point = {pos[0], pos[1], pos[2]};
+  std::array<std::array<int,2>,s_max_stack> stack;
+  int n_stack = 0;
+  if (size() > 0){stack[n_stack++] = {0, size()};}
+  while (n_stack > 0){
+    const std::array<int,2> range_of_nodes = stack[--n_stack];
+    const int node = rootOf(range_of_nodes[0], range_of_nodes[1]);
+    if (isOutOfRange(node, point, range)){continue;}
+    if (func(getPos(node), _rad[node])){return;}
+    assert(n_stack+2 <= s_max_stack);
+    // the left subtree is put on top, so that it is visited first
+    if (node+1 < range_of_nodes[1]){stack[n_stack++] = {node+1, range_of_nodes[1]};}
+    if (range_of_nodes[0] < node){stack[n_stack++] = {range_of_nodes[0], node};}
+  }
+}
+
+#endif
@@ -12,6 +12,29 @@
 #include <unordered_map>
 #include <math.h>
 
+// choices of the data structures and algorithms of a calculation. they only affect how fast the results are
+// obtained, except for cavity_tree, which adds the merge tree of the cavities to the results
+struct CalcOptions{
+  unsigned n_threads = 0; // 0: use all available threads
+  bool lazy_inheritance = false; // subvoxels of pure voxels are resolved through their parents instead of being written
+  bool sparse_octree = false; // subvoxels are only allocated for split voxels. implies lazy_inheritance
+  bool cell_list = false; // atoms near voxels are found with a uniform cell list instead of a 3-d tree
+  bool distance_transform = false; // the shell search starts at the distance to the closest probe core
+  bool cavity_tree = false; // the cavities are merged over decreasing probe radii, to find the bottleneck radii between them
+};
+
+// switches of a calculation started from the command line: what the structure includes, what is calculated, and
+// which files are exported once the calculation is done
+struct CalcSwitches{
+  bool include_hetatm = false;
+  bool unit_cell = false;
+  bool surface_areas = false;
+  bool probe_mode = false; // a large probe blocks off the areas that are inaccessible from the outside
+  bool export_report = false;
+  bool export_total_map = false;
+  bool export_cavity_maps = false;
+};
+
 struct CalcReportBundle{
   // calculation returned without error
   bool success;
@@ -27,6 +50,7 @@ struct CalcReportBundle{
   int max_depth;
   double r_probe1;
   double r_probe2;
+  CalcOptions options;
   std::vector<std::string> included_elements;
   std::string chemical_formula;
   double molar_mass;
@@ -50,11 +74,11 @@ struct CalcReportBundle{
   double getSurfProbeAccessible(){return surf_probe_accessible;}
   // cavity volumes and surfaces
   std::vector<Cavity> cavities;
-  double getCavVolume(const unsigned char i){return cavities[i].getVolume();}
-  std::array<double,3> getCavCentre(const unsigned char);
-  std::array<double,3> getCavCenter(const unsigned char i){return getCavCentre(i);}
-  double getCavSurfCore(const unsigned char i) const {return cavities[i].getSurfCore();}
-  double getCavSurfShell(const unsigned char i) const {return cavities[i].getSurfShell();}
+  double getCavVolume(const size_t i){return cavities[i].getVolume();}
+  std::array<double,3> getCavCentre(const size_t);
+  std::array<double,3> getCavCenter(const size_t i){return getCavCentre(i);}
+  double getCavSurfCore(const size_t i) const {return cavities[i].getSurfCore();}
+  double getCavSurfShell(const size_t i) const {return cavities[i].getSurfShell();}
   // time
   std::vector<double> elapsed_seconds;
   void addTime(const double t){elapsed_seconds.push_back(t);}
@@ -67,6 +91,10 @@ struct Atom;
 class Space;
 class Model{
   public:
+    // the controller is the monitor, unless the model runs on its own, e.g. side by side with other models
+    Model();
+    explicit Model(CalcMonitor&);
+
     // elements file import
     bool importElemFile(const std::string&);
     std::unordered_map<std::string, double> extractRadiusMap(const std::string&);
@@ -87,7 +115,7 @@ class Model{
     void writeTotalSurfaceMap(const std::string);
     void writeCavitiesMaps();
     void writeCavitiesMaps(const std::string);
-    void writeSurfaceMap(const std::string, double, std::array<unsigned long int,3>, std::array<double,3>, std::array<unsigned int,3>, std::array<unsigned int,3>, const bool=false, const unsigned char=0);
+    void writeSurfaceMap(const std::string, double, std::array<unsigned long int,3>, std::array<double,3>, std::array<unsigned int,3>, std::array<unsigned int,3>, const bool=false, const CavityID=0);
 
     std::vector<std::string> listElementsInStructure();
 
@@ -117,6 +145,7 @@ class Model{
     void linkToAdjacentAtoms(const double&, Atom&);
     bool setParameters(const std::string, const std::string, const bool, const bool, const bool, const bool, const double, const double, const double, const int, const bool, const bool, const bool, const std::unordered_map<std::string, double>, const std::vector<std::string>);
     std::vector<std::tuple<std::string, int, double>> generateAtomList();
+    const std::vector<Atom>& getAtomList() const {return _atoms;}
     void setRadiusMap(std::unordered_map<std::string, double> map);
     std::unordered_map<std::string,double> getRadiusMap();
     bool setProbeRadii(const double, const double, const bool);
@@ -129,6 +158,14 @@ class Model{
     void setProbeRad2(double r){_data.r_probe2 = r;}
     bool optionProbeMode(){return _data.probe_mode;}
     void toggleProbeMode(bool state){_data.probe_mode = state;}
+    const CalcOptions& getOptions(){return _data.options;}
+    void setOptions(const CalcOptions& options){_data.options = options;}
+    bool optionCellList(){return _data.options.cell_list;}
+    void setCellList(bool state){_data.options.cell_list = state;}
+    bool optionDistanceTransform(){return _data.options.distance_transform;}
+    void setDistanceTransform(bool state){_data.options.distance_transform = state;}
+    bool optionCavityTree(){return _data.options.cavity_tree;}
+    void setCavityTree(bool state){_data.options.cavity_tree = state;}
     bool optionIncludeHetatm(){return _data.inc_hetatm;}
     bool optionAnalyzeUnitCell(){return _data.analyze_unit_cell;}
     bool optionAnalyseUnitCell(){return _data.analyze_unit_cell;}
@@ -151,6 +188,10 @@ class Model{
     std::vector<Atom> _atoms;
     Space _cell;
     double _max_atom_radius = 0;
+    // receives the reports of the calculation and stops it. passed on to the space
+    CalcMonitor* _monitor;
+
+    bool isAborted() const {return _monitor->getAbortSignal().load(std::memory_order_relaxed);}
 
     void prepareVolumeCalc();
 };
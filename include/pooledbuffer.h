@@ -0,0 +1,51 @@
+#ifndef POOLEDBUFFER_H
+
+#define POOLEDBUFFER_H
+
+#include <memory>
+#include <vector>
+
+// an object, e.g. a list of candidate atoms, that is taken from a pool of the calling thread and returned to it
+// at the end of the scope. the object is not reset in between, so any vectors within keep their capacity and
+// evaluating a voxel no longer allocates memory once the pool has grown. the pool is a stack rather than one
+// object per octree level, because a thread waiting in ThreadPool::forkJoin may evaluate other voxels of the
+// same level in the meantime. if acquire is false, no object is taken and get() returns NULL
+template<typename T>
+class PooledBuffer{
+  public:
+    explicit PooledBuffer(const bool acquire = true){
+      if (!acquire){return;}
+      if (tl_free.empty()){
+        // returning the object must not allocate, since it happens in the destructor
+        tl_free.reserve(tl_n_objects + 1);
+        tl_n_objects++;
+        _object.reset(new T());
+      }
+      else {
+        _object = std::move(tl_free.back());
+        tl_free.pop_back();
+      }
+    }
+    ~PooledBuffer(){
+      if (_object){tl_free.push_back(std::move(_object));}
+    }
+    PooledBuffer(const PooledBuffer&) = delete;
+    PooledBuffer& operator=(const PooledBuffer&) = delete;
+
+    T* get() const {return _object.get();}
+    T& operator*() const {return *_object;}
+    T* operator->() const {return _object.get();}
+
+  private:
+    std::unique_ptr<T> _object;
+
+    static thread_local std::vector<std::unique_ptr<T>> tl_free;
+    static thread_local size_t tl_n_objects;
+};
+
+template<typename T>
+thread_local std::vector<std::unique_ptr<T>> PooledBuffer<T>::tl_free;
+template<typename T>
+thread_local size_t PooledBuffer<T>::tl_n_objects = 0;
+
+#endif
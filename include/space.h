@@ -5,18 +5,29 @@
 #include "voxel.h"
 #include "container3d.h"
 #include "cavity.h"
+#include "subvoxelpool.h"
+#include "cavityidtable.h"
 #include <vector>
 #include <array>
 #include <map>
+#include <functional>
+#include <memory>
+
+class ThreadPool;
+
+// memory layout of the voxel grids. can be changed at compile time, e.g. with -D GRID_LAYOUT=LayoutMorton
+#ifndef GRID_LAYOUT
+#define GRID_LAYOUT LayoutRowMajor
+#endif
+typedef Container3D<Voxel,GRID_LAYOUT> VoxelGrid;
 
 class AtomTree;
 struct Atom;
-class Voxel;
 class Space{
   public:
     // constructors
     Space() = default;
-    Space(std::vector<Atom>&, const double, const int, const double, const bool, const std::array<double,3>);
+    Space(std::vector<Atom>&, const double, const int, const double, const bool, const std::array<double,3>, const unsigned, const bool, const bool, CalcMonitor&);
 
     // access
     std::array <double,3> getMin();
@@ -26,7 +37,6 @@ class Space{
     bool isInBounds(const std::array<int,3>&, const unsigned);
     bool isInBounds(const std::array<unsigned,3>&, const unsigned);
     double getVxlSize() const;
-    Container3D<Voxel>& getGrid(const unsigned);
 
     // get voxel
     Voxel& getVxlFromGrid(const unsigned int, unsigned);
@@ -37,35 +47,41 @@ class Space{
     Voxel& getTopVxl(const unsigned int, const unsigned int, const unsigned int);
     Voxel& getTopVxl(const std::array<unsigned int,3>);
     Voxel& getTopVxl(const std::array<int,3>);
+    Voxel& resolveVxl(std::array<unsigned int,3>&, int&);
+    Voxel& resolveLeaf(std::array<unsigned int,3>&, int&);
+    Voxel& getResolvedVxl(std::array<unsigned int,3>, int);
+    Voxel& getResolvedVxl(const std::array<int,3>&, const int);
     const std::array<unsigned long,3> getGridsteps();
+    const std::array<unsigned long int,3> getGridstepsOnLvl(const int) const;
     std::array<std::array<unsigned int,3>,2> getUnitCellIndexes();
     unsigned long int totalVxlOnLvl(const int) const;
+    CavityID getCavityID(std::array<unsigned,3>, int);
+    void setCavityID(const std::array<unsigned,3>& index, const int lvl, const CavityID id){_cavity_ids->set(index, lvl, id);}
 
     int getMaxDepth(){return _max_depth;}
+    bool hasLazyInheritance() const {return _lazy_inheritance;}
+    bool isSparse() const {return _subvoxels != nullptr;}
+    unsigned long getNumSubvoxelBlocks();
+    void allocateSubvoxels(const std::array<unsigned,3>&, const int, const Voxel&);
     // output
     void printGrid();
 
     // type evaluation
-    void assignTypeInGrid(std::vector<Atom>&, const double, const double, bool, bool&);
+    void assignTypeInGrid(std::vector<Atom>&, const double, const double, bool, const AtomIndex::Engine, const bool, bool&);
     void getVolume(std::map<char,double>&, std::vector<Cavity>&);
     void getUnitCellVolume(std::map<char,double>&, std::vector<Cavity>&);
+    void buildCavityTree(std::vector<Atom>&, const double, const AtomIndex::Engine, std::vector<Cavity>&, bool&);
     void setUnitCellIndexes();
-    void tallyVoxelsUnitCell(std::array<unsigned int,3>,
-                            double,
-                            std::map<char, double>&,
-                            std::map<unsigned char, double>&,
-                            std::map<unsigned char, double>&,
-                            std::map<unsigned char, std::array<unsigned,3>>&,
-                            std::map<unsigned char, std::array<unsigned,3>>&);
+    Cavity makeCavity(const VolumeTally&, const CavityID, const double);
 
     // surface area
-    double calcSurfArea(const std::vector<char>&);
-    double calcSurfArea(const std::vector<char>&, const unsigned char, std::array<unsigned int,3>, std::array<unsigned int,3>);
+    void calcSurfAreas(const std::vector<std::vector<char>>&, const std::vector<char>&, const std::vector<char>&,
+                       std::vector<double>&, std::vector<Cavity>&);
 
   private:
     std::array <double,3> _cart_min; // this is also the "origin" of the space
     std::array <double,3> _cart_max;
-    std::vector<Container3D<Voxel>> _grid;
+    std::vector<VoxelGrid> _grid;
     std::array<unsigned int,3> _unit_cell_start_index; // bottom level voxels indexes for the start of the unit cell in x,y,z direction
     std::array<unsigned int,3> _unit_cell_end_index; // bottom level voxels indexes for the end of the unit cell in x,y,z direction
     std::array<double,3> _unit_cell_mod_index; // bottom level voxels fractional indexes for the end of the unit cell in x,y,z direction
@@ -73,30 +89,111 @@ class Space{
     int _max_depth; // for voxels
     std::array<double,3> _unit_cell_limits; // cartesian coordinates of the unit cell orthogonal axes
     bool _unit_cell; // option to analyze unit cell
+    unsigned _n_threads = 1; // number of threads used during type assignment
+    bool _lazy_inheritance = false; // if true, subvoxels of pure voxels are never written to
+    // sparse octree: only the top level is stored in _grid, all subvoxels are allocated on demand in the pool.
+    // null if the grid is dense
+    std::unique_ptr<SubvoxelPool> _subvoxels;
+    // IDs of the core and shell leaves that belong to a cavity
+    std::unique_ptr<CavityIDTable> _cavity_ids;
+    // receives the reports of all steps and stops them. a space without a monitor reports nothing, and has its own
+    // abort signal. on the heap, so that the pointer stays valid when the space is moved
+    std::unique_ptr<SilentMonitor> _silent_monitor = std::make_unique<SilentMonitor>();
+    CalcMonitor* _monitor = _silent_monitor.get();
 
     void setBoundaries(const std::vector<Atom>&, const double);
-
-    void initGrid();
-
-    const std::array<unsigned long int,3> getGridstepsOnLvl(const int) const;
-    void assignAtomVsCore();
-    void identifyCavities();
-    void descendToCore(unsigned char&, const std::array<unsigned,3>, int);
-    void assignShellVsVoid();
-
-    double tallySurface(const std::vector<char>&, std::array<unsigned int,3>&, std::array<unsigned int,3>&, const unsigned char=0, const bool=false);
-    unsigned char evalMarchingCubeConfig(const std::array<unsigned int,3>&, const std::vector<char>&, const unsigned char, const bool);
+    bool isAborted() const {return _monitor->getAbortSignal().load(std::memory_order_relaxed);}
+
+    void initGrid(const bool);
+
+    std::atomic<SubvoxelPool::Link>* findSubvoxelLink(std::array<unsigned,3>&, int&, const int);
+    Vector calcTopVxlPos(const std::array<unsigned,3>&);
+    void assignAtomVsCore(const CalcContext&);
+    void identifyCavities(const CalcContext&);
+    void collectCoreLeaves(std::vector<VoxelLoc>&, const std::array<unsigned,3>&, const int);
+    void assignShellVsVoid(const CalcContext&);
+    void prepareShellSearch(CalcContext&, const bool);
+    void computeCoreDistances(CalcContext&);
+    void forEachTopVxl(const CalcContext&, const std::function<unsigned(const std::array<unsigned,3>&)>&,
+                       const std::function<void(const std::array<unsigned,3>&)>&);
+    void forEachChunk(const CalcContext&, ThreadPool*, const unsigned long, const unsigned long,
+                      const std::function<void(unsigned long, unsigned long)>&);
+    void forEachSlab(const unsigned long, const std::function<void(unsigned long, unsigned)>&, const bool);
+
+    void forEachSurfaceBox(Voxel&, const std::array<unsigned,3>&, const int, const std::array<unsigned,3>&, const std::array<unsigned,3>&,
+                           const std::function<void(const std::array<unsigned,3>&, const std::array<unsigned,3>&)>&);
+    void forEachUnitCellBorderCube(const std::function<void(const std::array<unsigned,3>&, const double)>&);
 
 };
 
+// with lazy inheritance, subvoxels of pure voxels are never written to, so their content is meaningless. a
+// voxel is valid, if it is a top level voxel or if its parent has been split. otherwise, the closest valid
+// ancestor is pure and holds the type of the requested voxel. index and lvl are changed to the location
+// of that ancestor. called for every neighbour in the shell search, therefore defined in the header
+inline Voxel& Space::resolveVxl(std::array<unsigned int,3>& index, int& lvl){
+  if (!_lazy_inheritance){return _grid[lvl].getElement(index);}
+  return resolveLeaf(index, lvl);
+}
+
+// returns the leaf of the octree that contains the requested voxel, or the voxel itself if it has been split.
+// unlike resolveVxl, this also moves up to the leaf if the subvoxels hold a copy of their parent
+inline Voxel& Space::resolveLeaf(std::array<unsigned int,3>& index, int& lvl){
+  if (_subvoxels){
+    // sparse octree: descend from the top level voxel as far as the subvoxels exist
+    const int target_lvl = lvl;
+    const int shift = _max_depth-target_lvl;
+    std::array<unsigned int,3> vxl_index = {index[0] >> shift, index[1] >> shift, index[2] >> shift};
+    Voxel* vxl = &_grid[_max_depth].getElement(vxl_index);
+    SubvoxelPool::Link link = _subvoxels->getTopLink(vxl_index).load(std::memory_order_acquire);
+    for (lvl = _max_depth; lvl > target_lvl && link != 0; --lvl){
+      const int bit = lvl-target_lvl-1;
+      char octant = 0;
+      for (char i = 0; i < 3; ++i){
+        const unsigned int sub = (index[i] >> bit) & 1;
+        vxl_index[i] = vxl_index[i]*2 + sub;
+        octant |= sub << i;
+      }
+      SubvoxelPool::Block& block = _subvoxels->getBlock(link);
+      vxl = &block.vxl[octant];
+      link = block.sub[octant].load(std::memory_order_acquire);
+    }
+    index = vxl_index;
+    return *vxl;
+  }
+  while (lvl < _max_depth){
+    const std::array<unsigned int,3> parent_index = {index[0]/2, index[1]/2, index[2]/2};
+    if (_grid[lvl+1].getElement(parent_index).hasSubvoxel()){break;}
+    index = parent_index;
+    lvl++;
+  }
+  return _grid[lvl].getElement(index);
+}
+
+// the ID of the cavity that the voxel belongs to, which is stored for the leaf that contains it. only the core
+// and the shell of the small probe belong to cavities, the table is not accessed for any other leaf
+inline CavityID Space::getCavityID(std::array<unsigned,3> index, int lvl){
+  const Voxel& leaf = resolveLeaf(index, lvl);
+  if (leaf.hasSubvoxel() || !(leaf.getType() & 0b00011000)){return 0;}
+  return _cavity_ids->get(index, lvl);
+}
+
+inline Voxel& Space::getResolvedVxl(std::array<unsigned int,3> index, int lvl){
+  return resolveVxl(index, lvl);
+}
+
+inline Voxel& Space::getResolvedVxl(const std::array<int,3>& index, const int lvl){
+  return getResolvedVxl(std::array<unsigned int,3>{(unsigned)index[0], (unsigned)index[1], (unsigned)index[2]}, lvl);
+}
+
+// areas of the marching cube configurations in squared gridsteps. the tabulated areas have at most 4 decimals,
+// so they are stored as whole numbers of 1/s_units_per_area. sums of these units are exact and do not depend on
+// the order in which the cubes are added
 class SurfaceLUT {
   private:
-    static const std::array<unsigned char,256> types_by_config;
-    static const std::array<double, 15> area_by_type;
+    static const std::array<uint32_t, 256> units_by_config;
   public:
-    static unsigned char configToType(unsigned char config);
-    static double typeToArea(unsigned char type);
-    static double configToArea(unsigned char config);
+    static constexpr double s_units_per_area = 10000;
+    static uint32_t configToUnits(unsigned char config);
 };
 
 #endif
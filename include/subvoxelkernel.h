@@ -0,0 +1,66 @@
+#ifndef SUBVOXELKERNEL_H
+
+#define SUBVOXELKERNEL_H
+
+#include "vector.h"
+#include <vector>
+#include <array>
+
+// atoms that may influence the types of the subvoxels of a voxel. they are collected while the voxel itself
+// is evaluated, so that its subvoxels only check these atoms instead of searching the whole atom index again
+struct CandidateAtoms{
+  void add(const Vector& pos, const double r){
+    x.push_back(pos[0]);
+    y.push_back(pos[1]);
+    z.push_back(pos[2]);
+    rad.push_back(r);
+  }
+  void reserve(const int n){
+    x.reserve(n);
+    y.reserve(n);
+    z.reserve(n);
+    rad.reserve(n);
+  }
+  void clear(){
+    x.clear();
+    y.clear();
+    z.clear();
+    rad.clear();
+  }
+  int size() const {return rad.size();}
+  Vector getPos(const int i) const {return Vector(x[i], y[i], z[i]);}
+
+  std::vector<double> x;
+  std::vector<double> y;
+  std::vector<double> z;
+  std::vector<double> rad;
+};
+
+// relations between a voxel and the atoms, one bit each. a voxel may have several relations at once, e.g. if
+// it is partially inside one atom and touches the potential probe core of another. the relations are turned
+// into a type with the same rules as in Voxel::isAtom
+enum AtomRelation : char {
+  mvREL_NONE = 0,
+  mvREL_TOUCHING_CORE = 1 << 0, // outside the atom, but touching the potential probe core
+  mvREL_SHELL = 1 << 1, // outside the atom and not touching the potential probe core
+  mvREL_PARTIAL = 1 << 2, // partially inside the atom
+  mvREL_INSIDE = 1 << 3 // completely inside the atom
+};
+
+// result of evaluating a voxel together with its siblings: its relations to the atoms and the candidates
+// for its own subvoxels
+struct AtomRelations{
+  char relations = mvREL_NONE;
+  CandidateAtoms candidates;
+};
+
+// evaluates the 8 subvoxels of a voxel against all candidates of the voxel at once. per candidate, the squared
+// distances to the 8 subvoxel centres are computed side by side and compared to squared limits, which are the
+// same as in Voxel::isAtom. only subvoxels whose bit is set in active are evaluated, and the loop ends once
+// all of them are inside an atom. if collect is set, the candidates within range of a subvoxel are added to
+// its list. sub is reset first, so that it may be reused from voxel to voxel (see PooledBuffer). the instruction set is chosen at compile time: with AVX-512, the 8 subvoxels fit in one register,
+// with AVX in two. other targets use the scalar loop
+void classifySubvoxels(const CandidateAtoms&, const std::array<Vector,8>&, const double, const double, const double,
+                       const unsigned char, const bool, std::array<AtomRelations,8>&);
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef SUBVOXELPOOL_H
+
+#define SUBVOXELPOOL_H
+
+#include "voxel.h"
+#include <array>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+
+// storage for the subvoxels of a sparse octree. only the top level voxels are kept in a dense grid (see Space).
+// the 8 subvoxels of a voxel are allocated together as one block, once the voxel is split. a block is referred
+// to by its position in the pool. blocks are never moved or freed until the pool is destroyed, so that other
+// threads can keep reading while new blocks are allocated
+class SubvoxelPool{
+  public:
+    typedef unsigned Link; // position of a block in the pool. 0: the voxel has no subvoxels
+
+    struct Block{
+      std::array<Voxel,8> vxl; // the subvoxel i is offset by ((i>>0)&1, (i>>1)&1, (i>>2)&1) within its parent
+      std::array<std::atomic<Link>,8> sub; // subvoxels of each of the 8 voxels
+    };
+
+    SubvoxelPool(const std::array<unsigned long,3>&);
+
+    std::atomic<Link>& getTopLink(const std::array<unsigned,3>&);
+    Block& getBlock(const Link link){return _chunks[link >> s_chunk_bits][link & s_chunk_mask];}
+    Link allocate(const Voxel&);
+    unsigned long getNumBlocks();
+
+  private:
+    static inline const unsigned s_chunk_bits = 16;
+    static inline const Link s_chunk_mask = (Link(1) << s_chunk_bits) - 1;
+
+    std::array<unsigned long,3> _n_top_vxl;
+    std::vector<std::atomic<Link>> _top_links;
+    // the vector of chunks is never resized, so that reading a block does not require a lock
+    std::vector<std::unique_ptr<Block[]>> _chunks;
+    unsigned long _n_blocks = 1; // block 0 is never used
+    std::mutex _mutex;
+};
+
+#endif
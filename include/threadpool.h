@@ -0,0 +1,64 @@
+#ifndef THREADPOOL_H
+
+#define THREADPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <deque>
+#include <queue>
+#include <vector>
+
+// a fixed number of worker threads that execute submitted tasks. the thread that owns the pool
+// does not take part in the calculation, instead it is free to communicate with the user while
+// waiting for the workers to finish.
+// tasks running inside the pool may spawn subtasks with forkJoin(). each worker keeps its own
+// subtasks in a deque and works on the newest one first, while idle workers steal the oldest
+// (and therefore usually largest) subtask from the other workers.
+// an exception thrown by a task is passed on to the owner by waitForTasks, once all tasks have ended. the tasks
+// that have not started by then are dropped, because the calculation has failed anyway
+class ThreadPool{
+  public:
+    ThreadPool(const unsigned);
+    ~ThreadPool();
+
+    unsigned getNumThreads() const;
+    unsigned long getNumCompleted();
+
+    void submit(std::function<void()>);
+    bool waitForTasks(const std::chrono::milliseconds);
+
+    static unsigned getWorkerIndex();
+    static unsigned evalNumThreads(const unsigned);
+    static void forkJoin(const unsigned, const std::function<void(const unsigned)>&);
+  private:
+    struct TaskDeque{
+      std::mutex mutex;
+      std::deque<std::function<void()>> tasks;
+    };
+
+    std::vector<std::thread> _workers;
+    std::vector<std::unique_ptr<TaskDeque>> _deques; // spawned subtasks, one deque per worker
+    std::queue<std::function<void()>> _tasks; // submitted tasks, in order of submission
+    std::mutex _mutex;
+    std::condition_variable _task_available;
+    std::condition_variable _task_done;
+    std::atomic<unsigned long> _n_stealable{0};
+    unsigned long _n_unfinished = 0;
+    unsigned long _n_completed = 0;
+    bool _stop = false;
+    std::exception_ptr _error; // first exception thrown by a task
+
+    static thread_local ThreadPool* tl_pool;
+    static thread_local unsigned tl_worker;
+
+    void work(const unsigned);
+    bool runSpawnedTask(const unsigned);
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef UNIONFIND_H
+
+#define UNIONFIND_H
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+
+// disjoint sets of the elements 0..n-1, which may be merged by several threads at the same time without locks.
+// the root of each set is always its smallest element, so that the result does not depend on the order in which
+// sets are merged
+class UnionFind{
+  public:
+    typedef uint32_t Element;
+
+    UnionFind(const Element);
+
+    Element find(Element);
+    void unite(Element, Element);
+
+  private:
+    std::vector<std::atomic<Element>> _parent;
+};
+
+#endif
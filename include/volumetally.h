@@ -0,0 +1,41 @@
+#ifndef VOLUMETALLY_H
+
+#define VOLUMETALLY_H
+
+#include "cavity.h"
+#include <array>
+#include <vector>
+
+// number of bottom level voxels by type and by cavity, and the bounds of the voxels of each cavity. the counts
+// are stored in flat arrays indexed by the type code and the cavity ID, which grow with the largest ID found.
+// counts are stored as doubles, so that partial voxels at the border of a unit cell can be added as well. each
+// task fills its own tally, and the tallies are merged afterwards
+class VolumeTally{
+  public:
+    VolumeTally() = default;
+
+    void addVoxels(const char, const CavityID, const double, const std::array<unsigned,3>&, const std::array<unsigned,3>&);
+    void merge(const VolumeTally&, const double=1);
+
+    void getVolumes(std::map<char,double>&, const double) const;
+    double getTypeVoxels(const char type) const {return _type[(unsigned char)type];}
+    CavityID getMaxID() const {return _core.empty()? 0 : _core.size()-1;}
+    bool hasCore(const CavityID id) const {return id < _core_found.size() && _core_found[id];}
+    double getCore(const CavityID id) const {return _core[id];}
+    double getShell(const CavityID id) const {return _shell[id];}
+    const std::array<unsigned,3>& getMin(const CavityID id) const {return _min[id];}
+    const std::array<unsigned,3>& getMax(const CavityID id) const {return _max[id];}
+
+  private:
+    std::array<double,256> _type = {}; // by type code
+    std::array<bool,256> _type_found = {};
+    std::vector<double> _core; // by cavity ID
+    std::vector<double> _shell;
+    std::vector<bool> _core_found;
+    std::vector<std::array<unsigned,3>> _min;
+    std::vector<std::array<unsigned,3>> _max;
+
+    void reserveID(const CavityID);
+};
+
+#endif
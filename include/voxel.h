@@ -3,12 +3,20 @@
 #define VOXEL_H
 
 #include "vector.h"
-#include "atomtree.h"
+#include "atomindex.h"
+#include "subvoxelkernel.h"
+#include "coredistance.h"
+#include "corepyramid.h"
+#include "volumetally.h"
 #include "container3d.h"
+#include "misc.h"
+#include "cavity.h"
+#include "calcmonitor.h"
 #include <vector>
 #include <array>
 #include <unordered_map>
 #include <map>
+#include <atomic>
 
 struct SearchIndex{
   public:
@@ -25,79 +33,104 @@ struct SearchIndex{
 };
 
 class Space;
-class AtomTree;
 struct Atom;
-struct AtomNode;
-struct VoxelLoc;
+
+// location of a voxel in the octree
+struct VoxelLoc{
+  VoxelLoc(const std::array<unsigned,3>& index, const int lvl) : index(index), lvl(lvl) {}
+  std::array<unsigned,3> index;
+  int lvl;
+};
+
+// data shared by all voxels during the type assignment of one calculation. the context is passed through
+// the recursion instead of being stored in static members, so that several calculations can run at the
+// same time in one process
+struct CalcContext{
+  CalcContext(Space&, const std::vector<Atom>&, const AtomIndex::Engine, const double, CalcMonitor&);
+  void storeProbe(const double, const bool);
+  bool isAborted() const {return abort_flag.load(std::memory_order_relaxed);}
+  // bit of the voxel type that marks probe core of the current probe
+  char getCoreBit() const {return masking_mode? 5 : 3;}
+
+  Space& cell;
+  // atom vs core
+  const AtomIndex atom_index;
+  // shell vs void
+  double r_probe = 0;
+  bool masking_mode = false;
+  SearchIndex search_indices;
+  // built before each shell vs void assignment. the distances only with the distance transform engine
+  CorePyramid core_pyramid;
+  CoreDistanceMap core_distances;
+  // reports of the calculation, and the flag set by the monitor to stop it. the flag is checked for every voxel,
+  // hence the reference to the flag itself
+  CalcMonitor& monitor;
+  const std::atomic<bool>& abort_flag;
+};
+
+// the grid holds one voxel for every position on every level, therefore a voxel only holds its type. the cavity
+// IDs are stored apart, in the CavityIDTable of the Space.
+// during the shell vs void assignment, threads read the types of neighbours that another thread may be rewriting.
+// the type is therefore atomic. a split is published with a release store after the subvoxels have been written,
+// and the acquire load of a reader that sees the split also sees the subvoxels. on x86, both compile to plain moves
 class Voxel{
   public:
     Voxel();
+    Voxel(const Voxel& other) : _type(other.getType()) {}
+    Voxel& operator=(const Voxel& other){setType(other.getType()); return *this;}
 
-    Voxel& getSubvoxel(std::array<unsigned,3>, const unsigned, const std::array<char,3>&);
-    Voxel& getSubvoxel(std::array<unsigned,3>, const unsigned, const char);
-    Voxel& getSubvoxel(std::array<unsigned,3>, const unsigned);
-    void setType(char);
-    char getType() const;
-    void setID(unsigned char);
-    unsigned char getID() const;
+    Voxel& getSubvoxel(Space&, std::array<unsigned,3>, const unsigned, const std::array<char,3>&);
+    Voxel& getSubvoxel(Space&, std::array<unsigned,3>, const unsigned, const char);
+    Voxel& getSubvoxel(Space&, std::array<unsigned,3>, const unsigned);
+    void setType(char input){_type.store(input, std::memory_order_release);}
+    char getType() const {return _type.load(std::memory_order_acquire);}
 
     // bitwise operations on _type
-    bool hasSubvoxel(); // state of bit 7
-    bool isCore(); // state of bit 3
-    bool isAssigned(); // state of bit 0
+    bool hasSubvoxel() const {return readBit(getType(),7);}
+    bool isCore() const {return readBit(getType(),3);}
+    bool isAssigned() const {return readBit(getType(),0);}
+
+    // radius of the sphere around the voxel centre that contains the centres of all bottom level subvoxels
+    static double calcVxlRadius(const double grid_size, const double& lvl){
+      return lvl != 0 ? 0.86602540378 * grid_size * (pow(2,lvl) - 1) : 0;
+    }
 
     // calc preparation
-    static void prepareTypeAssignment(Space*, std::vector<Atom>&);
-    static void storeProbe(const double, const bool);
     static void computeIndices();
     static void computeIndices(unsigned int);
 
     // atom vs probe core
-    char evalRelationToAtoms(const std::array<unsigned,3>&, Vector, const int);
-    void traverseTree(const AtomNode*, const double, const Vector&, const double, const double, const int,
-        const char = 0b00000011, const char = 0);
-    void passTypeToChildren(const std::array<unsigned,3>&, const int);
-    void splitVoxel(const std::array<unsigned,3>&, const Vector&, const double);
+    char evalRelationToAtoms(const CalcContext&, const std::array<unsigned,3>&, Vector, const int, AtomRelations* = NULL);
+    void traverseTree(const CalcContext&, const Vector&, const double, const double, CandidateAtoms*);
+    void passTypeToChildren(Space&, const std::array<unsigned,3>&, const int);
+    void materializeSubvoxels(Space&, const std::array<unsigned,3>&, const int, const char);
+    void splitVoxel(const CalcContext&, const std::array<unsigned,3>&, const Vector&, const double, const CandidateAtoms&);
+    static unsigned countNearbyAtoms(const CalcContext&, const Vector&, const int);
 
     // cavity id
-    bool floodFill(const unsigned char, const std::array<unsigned,3>&, const int);
+    void listBorderingCoreLeaves(Space&, std::vector<VoxelLoc>&, const std::array<unsigned,3>&, const int, const std::array<int,3>&);
 
     // shell vs void
-    char evalRelationToVoxels(const std::array<unsigned int,3>&, const unsigned, bool=false);
+    char evalRelationToVoxels(const CalcContext&, const std::array<unsigned int,3>&, const unsigned, bool=false);
 
     // volume
-    void tallyVoxelsOfType(std::map<char,unsigned>&,
-        std::map<unsigned char,unsigned>&,
-        std::map<unsigned char,unsigned>&,
-        std::map<unsigned char,std::array<unsigned,3>>&,
-        std::map<unsigned char,std::array<unsigned,3>>&,
-        const std::array<unsigned,3>&,
-        const int);
-
-    // unused but could become useful
-    static void listFromTree(std::vector<int>&, const AtomNode*, const Vector&, const double&, const double&, const double&, const char=0);
+    void tallyVoxelsOfType(Space&, VolumeTally&, const std::array<unsigned,3>&, const int);
+    void tallyVoxelsInBox(Space&, VolumeTally&, const std::array<unsigned,3>&, const int, const std::array<unsigned,3>&, const std::array<unsigned,3>&);
+
   private:
-    char _type;
-    unsigned char _identity;
+    std::atomic<char> _type;
 
-    static inline Space* s_cell; // gets destroyed by Model
-    // atom vs core
-    static inline AtomTree* s_atomtree;
-    // shell vs void
-    static inline double s_r_probe;
-    static inline bool s_masking_mode;
-    static inline SearchIndex s_search_indices;
+    // voxels on this level or above spawn the evaluation of their subvoxels as separate tasks
+    static inline const int s_min_spawn_lvl = 2;
+    // candidates are collected with a slightly larger range, so that rounding can never lose an atom
+    static inline const double s_candidate_margin = 1e-9;
 
-    static inline double calcVxlRadius(const double& max_depth);
 
     // atom vs core
-    bool isAtom(const Atom&, const Vector&, const double, const double);
-    // cavity id
-    void descend(std::vector<VoxelLoc>&, const unsigned char, const std::array<unsigned,3>&, const int, const std::array<int,3>&);
-    void ascend(std::vector<VoxelLoc>&, const unsigned char, const std::array<unsigned,3>, const int, std::array<unsigned,3>, const std::array<int,3>&);
-    void passIDtoChildren(const std::array<unsigned,3>&, const int);
+    bool isAtom(const CalcContext&, const Vector&, const double, const Vector&, const double, const double);
+    void applyAtomRelations(const CalcContext&, const char);
     // shell vs void
-    bool searchForCore(const std::array<unsigned int,3>&, const unsigned, bool=false);
+    bool searchForCore(const CalcContext&, const std::array<unsigned int,3>&, const unsigned, bool=false);
 };
 
 #endif
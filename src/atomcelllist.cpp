@@ -0,0 +1,51 @@
+#include "atomcelllist.h"
+#include "atom.h"
+
+/////////////////
+// CONSTRUCTOR //
+/////////////////
+
+// the edge of a cell is the largest atom radius plus the probe radius. the atoms are sorted into the cells
+// with a counting sort. within a cell, the atoms keep their input order
+AtomCellList::AtomCellList(const std::vector<Atom>& list_of_atoms, const double r_probe){
+  if (list_of_atoms.empty()){return;}
+  std::array<double,3> max;
+  _origin = list_of_atoms[0].getPos();
+  max = _origin;
+  for (const Atom& atom : list_of_atoms){
+    for (char dim = 0; dim < 3; ++dim){
+      _origin[dim] = std::min(_origin[dim], atom.getCoordinate(dim));
+      max[dim] = std::max(max[dim], atom.getCoordinate(dim));
+    }
+    _max_rad = std::max(_max_rad, atom.getRad());
+  }
+  // tiny cells would lead to an enormous grid, e.g. for a structure of hydrogen atoms without probe
+  _cell_size = std::max(_max_rad + r_probe, 0.5);
+  for (char dim = 0; dim < 3; ++dim){
+    _n_cells[dim] = 1 + long((max[dim] - _origin[dim]) / _cell_size);
+  }
+
+  std::vector<unsigned> atom_cell(list_of_atoms.size());
+  _cell_start = std::vector<unsigned>(_n_cells[0] * _n_cells[1] * _n_cells[2] + 1, 0);
+  for (size_t i = 0; i < list_of_atoms.size(); ++i){
+    atom_cell[i] = (cellCoord(list_of_atoms[i].pos_z, 2) * _n_cells[1] + cellCoord(list_of_atoms[i].pos_y, 1)) * _n_cells[0]
+      + cellCoord(list_of_atoms[i].pos_x, 0);
+    _cell_start[atom_cell[i] + 1]++;
+  }
+  for (size_t cell = 1; cell < _cell_start.size(); ++cell){
+    _cell_start[cell] += _cell_start[cell-1];
+  }
+
+  std::vector<unsigned> next = _cell_start;
+  for (char dim = 0; dim < 3; ++dim){
+    _pos[dim].resize(list_of_atoms.size());
+  }
+  _rad.resize(list_of_atoms.size());
+  for (size_t i = 0; i < list_of_atoms.size(); ++i){
+    const unsigned j = next[atom_cell[i]]++;
+    for (char dim = 0; dim < 3; ++dim){
+      _pos[dim][j] = list_of_atoms[i].getCoordinate(dim);
+    }
+    _rad[j] = list_of_atoms[i].getRad();
+  }
+}
@@ -0,0 +1,16 @@
+#include "atomindex.h"
+#include "atom.h"
+
+/////////////////
+// CONSTRUCTOR //
+/////////////////
+
+// the probe radius determines the cell size of the cell list
+AtomIndex::AtomIndex(const std::vector<Atom>& list_of_atoms, const Engine engine, const double r_probe) : _engine(engine) {
+  if (_engine == CellList){
+    _cell_list = AtomCellList(list_of_atoms, r_probe);
+  }
+  else {
+    _tree = FlatAtomTree(list_of_atoms);
+  }
+}
@@ -2,13 +2,14 @@
 #include "atomtree.h"
 #include "atom.h"
 #include "misc.h"
+#include "vector.h"
 #include <cmath>
+#include <algorithm> // min, max
 
 ///////////////////
 // AUX FUNCTIONS //
 ///////////////////
 
-double findMaxRad(std::vector<Atom>& list_of_atoms);
 void findAdjacentRecursive(std::vector<Atom*>&, const Atom&, const double& shell_to_shell_dist, const double& min_distance, const AtomNode* node, int dim);
 
 //////////////
@@ -17,7 +18,22 @@ void findAdjacentRecursive(std::vector<Atom*>&, const Atom&, const double& shell
 
 // CONSTRUCTOR
 
-AtomNode::AtomNode(int atom_id, AtomNode* left_node, AtomNode* right_node) : _left_child(left_node), _right_child(right_node), _atom_id(atom_id) {}
+// the children have to be constructed first, because the bounds of the subtree are merged from their bounds
+AtomNode::AtomNode(int atom_id, AtomNode* left_node, AtomNode* right_node, const std::vector<Atom>& list_of_atoms)
+  : _left_child(left_node), _right_child(right_node), _atom_id(atom_id) {
+  const Atom& atom = list_of_atoms[atom_id];
+  _box_min = atom.getPos();
+  _box_max = atom.getPos();
+  _max_rad = atom.getRad();
+  for (const AtomNode* child : {_left_child, _right_child}){
+    if (child == NULL){continue;}
+    for (char dim = 0; dim < 3; ++dim){
+      _box_min[dim] = std::min(_box_min[dim], child->_box_min[dim]);
+      _box_max[dim] = std::max(_box_max[dim], child->_box_max[dim]);
+    }
+    _max_rad = std::max(_max_rad, child->_max_rad);
+  }
+}
 
 // DESTRUCTOR
 
@@ -36,40 +52,43 @@ AtomNode* AtomNode::getRightChild() const {
   return _right_child;
 }
 
-void AtomNode::setAtomList(const std::vector<Atom>& atom_list){
-  AtomNode::s_atom_list = atom_list;
-}
-
-std::vector<Atom>& AtomNode::getAtomList(){
-  return s_atom_list;
-}
-
-Atom& AtomNode::getAtom() const {
-  return AtomNode::getAtom(_atom_id);
+int AtomNode::getAtomId() const {
+  return _atom_id;
 }
 
-Atom& AtomNode::getAtom(const int atom_id){
-  return s_atom_list[atom_id];
+double AtomNode::getMaxRad() const {
+  return _max_rad;
 }
 
-int AtomNode::getAtomId() const {
-  return _atom_id;
+// returns true if no atom in the subtree comes closer to the point than the given range. the distance is
+// measured from the point to the bounding box of the atom centres, minus the largest radius in the subtree
+bool AtomNode::isOutOfRange(const Vector& point, const double range) const {
+  double dist_squared = 0;
+  for (char dim = 0; dim < 3; ++dim){
+    double excess = 0;
+    if (point[dim] < _box_min[dim]){excess = _box_min[dim] - point[dim];}
+    else if (point[dim] > _box_max[dim]){excess = point[dim] - _box_max[dim];}
+    dist_squared += excess * excess;
+  }
+  const double reach = range + _max_rad;
+  return dist_squared > reach * reach;
 }
 
 // OTHER
-void AtomNode::print(){
-  std::cout << getAtom().symbol << "("
-    << getAtom().getCoordinate(0) << ","
-    << getAtom().getCoordinate(1) << ","
-    << getAtom().getCoordinate(2) << ")";
+void AtomNode::print(const AtomTree& tree) const {
+  const Atom& atom = tree.getAtom(this);
+  std::cout << atom.symbol << "("
+    << atom.getCoordinate(0) << ","
+    << atom.getCoordinate(1) << ","
+    << atom.getCoordinate(2) << ")";
 
   std::cout << "(-";
   if(getLeftChild() != NULL){
-    getLeftChild()->print();
+    getLeftChild()->print(tree);
   }
   std::cout << " +";
   if(getRightChild() != NULL){
-    getRightChild()->print();
+    getRightChild()->print(tree);
   }
   std::cout << ")";
   return;
@@ -86,14 +105,10 @@ AtomTree::AtomTree(){
   _max_rad = 0;
 }
 
-AtomTree::AtomTree(const std::vector<Atom>& list_of_atoms){
-  AtomNode::setAtomList(list_of_atoms);
-  _root = buildTree(0, AtomNode::getAtomList().size(), 0);
-  // ideally, the maximum radius would be the largest radius among all children of a node.
-  // this, however, may require running an algorithm for every tree node, increasing the
-  // complexity of the operation. it is much simpler to use the maximum radius among all
-  // atoms instead, sacrificing optimisation.
-  _max_rad = findMaxRad(AtomNode::getAtomList());
+AtomTree::AtomTree(const std::vector<Atom>& list_of_atoms) : _atom_list(list_of_atoms) {
+  _root = buildTree(0, _atom_list.size(), 0);
+  // every node stores the largest radius in its subtree, so the root holds the largest radius of all atoms
+  _max_rad = (_root == NULL)? 0 : _root->getMaxRad();
 }
 
 // DESTRUCTOR
@@ -118,27 +133,18 @@ AtomNode* AtomTree::buildTree(
   }
   // if list of atoms has exactly one atom left
   else if((vec_end-vec_first)==1){
-    return new AtomNode(vec_first,NULL,NULL);
+    return new AtomNode(vec_first,NULL,NULL,_atom_list);
   }
 
   else{
-    quicksort(AtomNode::getAtomList(), vec_first, vec_end, dim);
+    quicksort(_atom_list, vec_first, vec_end, dim);
     int median = vec_first + (vec_end-vec_first)/2; // operation rounds down
-    return new AtomNode(median, buildTree(vec_first, median, (dim+1)%3), buildTree(median+1, vec_end, (dim+1)%3));
-  }
-}
-
-double findMaxRad(std::vector<Atom>& list_of_atoms){
-  double max_rad = 0;
-  for (size_t atom = 0; atom < list_of_atoms.size(); atom++){
-    if (list_of_atoms[atom].getRad() > max_rad){
-      max_rad = list_of_atoms[atom].getRad();
-    }
+    AtomNode* left_node = buildTree(vec_first, median, (dim+1)%3);
+    AtomNode* right_node = buildTree(median+1, vec_end, (dim+1)%3);
+    return new AtomNode(median, left_node, right_node, _atom_list);
   }
-  return max_rad;
 }
 
-
 void AtomTree::quicksort(std::vector<Atom>& list_of_atoms, const int& vec_first, const int& vec_end, const char& dim){
 
   if(vec_first >= vec_end-1){
@@ -175,7 +181,7 @@ void AtomTree::print() const {
     std::cout << "Tree empty" << std::endl;
   }
   else{
-    _root->print();
+    _root->print(*this);
   }
   std::cout << std::endl;
   return;
@@ -190,3 +196,15 @@ const double AtomTree::getMaxRad() const {
 const AtomNode* AtomTree::getRoot() const {
   return _root;
 }
+
+const Atom& AtomTree::getAtom(const AtomNode* node) const {
+  return _atom_list[node->getAtomId()];
+}
+
+const Atom& AtomTree::getAtom(const int atom_id) const {
+  return _atom_list[atom_id];
+}
+
+const std::vector<Atom>& AtomTree::getAtomList() const {
+  return _atom_list;
+}
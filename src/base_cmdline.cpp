@@ -6,18 +6,20 @@
 
 #include "base.h"
 #include "controller.h"
+#include "model.h"
 #include "misc.h"
 #include "flags.h"
 #include "special_chars.h"
 #include <cassert>
 #include <sstream>
+#include <string> // stod
 
 // contains all command line options
 static const wxCmdLineEntryDesc s_cmd_line_desc[] =
 {
   { wxCMD_LINE_SWITCH, "h", "help", "Display help for command line interface", wxCMD_LINE_VAL_NONE, wxCMD_LINE_OPTION_HELP},
   // required
-  { wxCMD_LINE_OPTION, "r", "radius", "Probe radius", wxCMD_LINE_VAL_DOUBLE},
+  { wxCMD_LINE_OPTION, "r", "radius", "Probe radius, or several comma separated radii to calculate one after another", wxCMD_LINE_VAL_STRING},
   { wxCMD_LINE_OPTION, "g", "grid", "Spatial resolution of the underlying grid", wxCMD_LINE_VAL_DOUBLE},
   { wxCMD_LINE_OPTION, "fs", "file-structure", "Path to the structure file", wxCMD_LINE_VAL_STRING},
   // optional
@@ -25,6 +27,12 @@ static const wxCmdLineEntryDesc s_cmd_line_desc[] =
   { wxCMD_LINE_OPTION, "do", "dir-output", "Path to the output directory", wxCMD_LINE_VAL_STRING},
   { wxCMD_LINE_OPTION, "r2", "radius2", "Large probe radius (for two-probe mode)", wxCMD_LINE_VAL_DOUBLE},
   { wxCMD_LINE_OPTION, "d", "depth", "Octree depth", wxCMD_LINE_VAL_NUMBER},
+  { wxCMD_LINE_OPTION, "t", "threads", "Number of threads (default:all available)", wxCMD_LINE_VAL_NUMBER},
+  { wxCMD_LINE_SWITCH, "lz", "lazy", "Look up types of subvoxels from their parents instead of copying them", wxCMD_LINE_VAL_NONE, 0},
+  { wxCMD_LINE_SWITCH, "sp", "sparse", "Only allocate memory for subvoxels of split voxels (implies:--lazy)", wxCMD_LINE_VAL_NONE, 0},
+  { wxCMD_LINE_SWITCH, "cl", "celllist", "Find atoms near voxels with a uniform cell list instead of a 3-d tree", wxCMD_LINE_VAL_NONE, 0},
+  { wxCMD_LINE_SWITCH, "dt", "edt", "Compute distances to probe cores with a distance transform before the shell search", wxCMD_LINE_VAL_NONE, 0},
+  { wxCMD_LINE_SWITCH, "ct", "cavitytree", "Report the largest probe fitting into each cavity and the bottleneck probe radii between cavities", wxCMD_LINE_VAL_NONE, 0},
   { wxCMD_LINE_SWITCH, "ht", "hetatm", "Include HETATM from pdb file", wxCMD_LINE_VAL_NONE, 0},
   { wxCMD_LINE_SWITCH, "uc", "unitcell", "Evaluate unit cell", wxCMD_LINE_VAL_NONE, 0},
   { wxCMD_LINE_SWITCH, "sf", "surface", "Calculate surfaces", wxCMD_LINE_VAL_NONE, 0},
@@ -41,7 +49,8 @@ static const wxCmdLineEntryDesc s_cmd_line_desc[] =
 
 static const std::vector<std::string> s_required_args = {"r", "g", "fs"};
 
-bool validateProbes(const double, const double, const bool);
+bool parseProbeRadii(const std::string, std::vector<double>&);
+bool validateProbes(const std::vector<double>&, const double, const bool);
 bool validateExport(const std::string, const std::vector<bool>);
 bool validatePdb(const std::string, const bool, const bool);
 unsigned evalDisplayOptions(const std::string);
@@ -84,6 +93,39 @@ void MainApp::evalCmdLine(){
     else if (unittest_id=="floodfill"){
       Ctrl::getInstance()->unittestFloodfill();
     }
+    else if (unittest_id=="layout"){
+      Ctrl::getInstance()->unittestLayout();
+    }
+    else if (unittest_id=="atomtree"){
+      Ctrl::getInstance()->unittestAtomTree();
+    }
+    else if (unittest_id=="atomindex"){
+      Ctrl::getInstance()->unittestAtomIndex();
+    }
+    else if (unittest_id=="edt"){
+      Ctrl::getInstance()->unittestDistanceTransform();
+    }
+    else if (unittest_id=="cavitytree"){
+      Ctrl::getInstance()->unittestCavityTree();
+    }
+    else if (unittest_id=="threadpool"){
+      Ctrl::getInstance()->unittestThreadPool();
+    }
+    else if (unittest_id=="pooledbuffer"){
+      Ctrl::getInstance()->unittestPooledBuffer();
+    }
+    else if (unittest_id=="atomorder"){
+      Ctrl::getInstance()->unittestAtomOrder();
+    }
+    else if (unittest_id=="calcmonitor"){
+      Ctrl::getInstance()->unittestCalcMonitor();
+    }
+    else if (unittest_id=="modelmonitor"){
+      Ctrl::getInstance()->unittestModelMonitor();
+    }
+    else if (unittest_id=="subvoxelkernel"){
+      Ctrl::getInstance()->unittestSubvoxelKernel();
+    }
     else {
       std::cout << "Invalid selection" << std::endl;
     }
@@ -100,7 +142,7 @@ void MainApp::evalCmdLine(){
   Ctrl::getInstance()->hush(parser.Found("q"));
 
   // minimum required arguments for calculation
-  double probe_radius_s;
+  wxString probe_radius_s;
   double grid_resolution;
   wxString structure_file_path;
 
@@ -114,30 +156,35 @@ void MainApp::evalCmdLine(){
   wxString output = "all";
   double probe_radius_l = 0;
   long tree_depth = 4;
-  bool opt_include_hetatm = false;
-  bool opt_unit_cell = false;
-  bool opt_surface_area = false;
-  bool opt_probe_mode = false;
-  bool exp_report = false;
-  bool exp_total_map = false;
-  bool exp_cavity_maps = false;
+  long n_threads = 0;
+  CalcOptions options;
+  CalcSwitches switches;
 
   parser.Found("fe",&elements_file_path);
   parser.Found("do",&output_dir_path);
   parser.Found("o",&output);
   parser.Found("r2",&probe_radius_l);
   parser.Found("d",&tree_depth);
-  opt_include_hetatm = parser.Found("ht");
-  opt_unit_cell = parser.Found("uc");
-  opt_surface_area = parser.Found("sf");
-  opt_probe_mode = parser.Found("r") && parser.Found("r2");
-  exp_report = parser.Found("xr");
-  exp_total_map = parser.Found("xt");
-  exp_cavity_maps = parser.Found("xc");
-
-  if(!validateProbes(probe_radius_s, probe_radius_l, opt_probe_mode)
-      || !validateExport(output_dir_path.ToStdString(), {exp_report, exp_total_map, exp_cavity_maps})
-      || !validatePdb(structure_file_path.ToStdString(), opt_include_hetatm, opt_unit_cell)){
+  parser.Found("t",&n_threads);
+  options.n_threads = (unsigned)std::max(n_threads,0L);
+  options.lazy_inheritance = parser.Found("lz");
+  options.sparse_octree = parser.Found("sp");
+  options.cell_list = parser.Found("cl");
+  options.distance_transform = parser.Found("dt");
+  options.cavity_tree = parser.Found("ct");
+  switches.include_hetatm = parser.Found("ht");
+  switches.unit_cell = parser.Found("uc");
+  switches.surface_areas = parser.Found("sf");
+  switches.probe_mode = parser.Found("r") && parser.Found("r2");
+  switches.export_report = parser.Found("xr");
+  switches.export_total_map = parser.Found("xt");
+  switches.export_cavity_maps = parser.Found("xc");
+
+  std::vector<double> probe_radii_s;
+  if(!parseProbeRadii(probe_radius_s.ToStdString(), probe_radii_s)
+      || !validateProbes(probe_radii_s, probe_radius_l, switches.probe_mode)
+      || !validateExport(output_dir_path.ToStdString(), {switches.export_report, switches.export_total_map, switches.export_cavity_maps})
+      || !validatePdb(structure_file_path.ToStdString(), switches.include_hetatm, switches.unit_cell)){
     return;
   }
 
@@ -145,27 +192,41 @@ void MainApp::evalCmdLine(){
 
   // run calculation
   Ctrl::getInstance()->runCalculation(
-      probe_radius_s,
+      probe_radii_s,
       probe_radius_l,
       grid_resolution,
       structure_file_path.ToStdString(),
       elements_file_path.ToStdString(),
       output_dir_path.ToStdString(),
       (int)tree_depth,
-      opt_include_hetatm,
-      opt_unit_cell,
-      opt_surface_area,
-      opt_probe_mode,
-      exp_report,
-      exp_total_map,
-      exp_cavity_maps,
+      options,
+      switches,
       display_flag);
 }
 
-bool validateProbes(const double r1, const double r2, const bool pm){
-  if(pm && r2 < r1){
-    Ctrl::getInstance()->displayErrorMessage(104);
-    return false;
+// several radii are separated by commas. each of them must be a number without any trailing characters
+bool parseProbeRadii(const std::string input, std::vector<double>& radii){
+  std::stringstream ss(input);
+  while(ss.good()){
+    std::string substr;
+    getline(ss, substr, ',');
+    size_t pos = 0;
+    try{radii.push_back(std::stod(substr, &pos));}
+    catch (const std::exception& e){pos = 0;}
+    if (pos == 0 || pos != substr.size()){
+      Ctrl::getInstance()->displayErrorMessage(109);
+      return false;
+    }
+  }
+  return true;
+}
+
+bool validateProbes(const std::vector<double>& radii_s, const double r2, const bool pm){
+  for (const double r1 : radii_s){
+    if(pm && r2 < r1){
+      Ctrl::getInstance()->displayErrorMessage(104);
+      return false;
+    }
   }
   return true;
 }
@@ -26,3 +26,12 @@ bool compareVolume(const Cavity& a, const Cavity& b){
 void inverseSort(std::vector<Cavity>& cavities){
   std::sort(cavities.rbegin(), cavities.rend(), compareVolume);
 }
+
+// the number under which each cavity is listed in the output, i.e. its position in the list + 1, by cavity ID
+std::map<CavityID,size_t> listCavityNumbers(const std::vector<Cavity>& cavities){
+  std::map<CavityID,size_t> numbers;
+  for (size_t i = 0; i < cavities.size(); ++i){
+    numbers[cavities[i].id] = i+1;
+  }
+  return numbers;
+}
@@ -0,0 +1,43 @@
+#include "cavityidtable.h"
+#include <algorithm> // min
+
+/////////////////
+// CONSTRUCTOR //
+/////////////////
+
+// the table covers the top level voxels n_top_vxl of an octree with the given depth. pages cover a few levels
+// only, so that a thin layer of shell leaves does not allocate slots for the voxels far from it
+CavityIDTable::CavityIDTable(const std::array<unsigned long,3>& n_top_vxl, const int max_depth)
+  : _page_lvl(std::min(s_page_lvl, max_depth)) {
+  for (char i = 0; i < 3; ++i){
+    _n_pages[i] = n_top_vxl[i] << (max_depth - _page_lvl);
+  }
+  _pages = std::vector<std::atomic<CavityID*>>(_n_pages[0]*_n_pages[1]*_n_pages[2]);
+  for (std::atomic<CavityID*>& page : _pages){
+    page.store(nullptr, std::memory_order_relaxed);
+  }
+}
+
+CavityIDTable::~CavityIDTable(){
+  for (std::atomic<CavityID*>& page : _pages){
+    delete[] page.load(std::memory_order_relaxed);
+  }
+}
+
+////////////
+// ACCESS //
+////////////
+
+// the first thread to write into a page allocates it. a thread that loses the race discards its own page
+void CavityIDTable::set(const std::array<unsigned,3>& index, const int lvl, const CavityID id){
+  unsigned long slot;
+  std::atomic<CavityID*>& page = _pages[locate(index, lvl, slot)];
+  CavityID* data = page.load(std::memory_order_acquire);
+  if (data == nullptr){
+    if (id == 0){return;}
+    CavityID* new_data = new CavityID[1ul << (3*_page_lvl)]();
+    if (page.compare_exchange_strong(data, new_data, std::memory_order_acq_rel)){data = new_data;}
+    else {delete[] new_data;}
+  }
+  data[slot] = id;
+}
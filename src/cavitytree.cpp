@@ -0,0 +1,264 @@
+#include "cavitytree.h"
+#include "space.h"
+#include "voxel.h"
+#include "unionfind.h"
+#include "pooledbuffer.h"
+#include <cmath>
+#include <limits>
+#include <algorithm> // min, max, sort
+#include <stdexcept>
+
+/////////////////
+// CONSTRUCTOR //
+/////////////////
+
+CavityTree::CavityTree(Space& cell)
+  : _grid_size(cell.getVxlSize()), _max_depth(cell.getMaxDepth()), _origin(cell.getOrigin()), _n_vxl(cell.getGridstepsOnLvl(0)) {
+  for (int lvl = 0; lvl <= _max_depth; ++lvl){
+    _rad_vxl.push_back(Voxel::calcVxlRadius(_grid_size, lvl));
+  }
+  _clearance.resize(_n_vxl[0]*_n_vxl[1]*_n_vxl[2]);
+  _cavity.resize(_clearance.size());
+}
+
+///////////////
+// CLEARANCE //
+///////////////
+
+// the closest atom surface to the centre is found by widening the search range, until an atom surface lies
+// within it. no other atom can be the closest surface to any point of the voxel, if its surface is further
+// away from the centre than that plus twice the voxel radius
+void CavityTree::evalTopVxl(const CalcContext& ctx, const std::array<unsigned,3>& index, const Vector& pos){
+  const double max_range = 2 * _grid_size * (_n_vxl[0] + _n_vxl[1] + _n_vxl[2]);
+  double clearance = std::numeric_limits<double>::max();
+  for (double range = std::max(_rad_vxl[_max_depth], _grid_size); clearance >= range && range < max_range; range *= 2){
+    ctx.atom_index.forEachAtomInRange(pos, range, [&](const Vector& pos_atom, const double rad_atom){
+      clearance = std::min(clearance, distance(pos, pos_atom) - rad_atom);
+      return false;
+    });
+  }
+  const double range = clearance + 2*_rad_vxl[_max_depth] + s_candidate_margin;
+  PooledBuffer<CandidateAtoms> candidates;
+  candidates->clear();
+  ctx.atom_index.forEachAtomInRange(pos, range, [&](const Vector& pos_atom, const double rad_atom){
+    if ((pos-pos_atom) < range + rad_atom){candidates->add(pos_atom, rad_atom);}
+    return false;
+  });
+  evalVxl(ctx.cell, index, _max_depth, pos, *candidates, &ctx.cell.getTopVxl(index), 0);
+}
+
+static double calcClearance(const Vector& pos, const CandidateAtoms& candidates){
+  double clearance = std::numeric_limits<double>::max();
+  for (int i = 0; i < candidates.size(); ++i){
+    clearance = std::min(clearance, distance(pos, candidates.getPos(i)) - candidates.rad[i]);
+  }
+  return clearance;
+}
+
+// the cavity of a leaf of the octree. the space of the large probe in the two probe mode separates cavities for
+// any radius of the small probe, and is therefore not added to the tree
+static CavityID getLeafCavity(Space& cell, const std::array<unsigned,3>& index, const int lvl, const Voxel& vxl){
+  if (vxl.isCore()){return cell.getCavityID(index, lvl);}
+  return (vxl.getType() & 0b01100000)? CavityTree::s_masked : 0;
+}
+
+// the clearance of a subvoxel centre is at most the clearance of the parent centre plus the distance between
+// the centres, which limits the candidates of the subvoxel. voxels completely inside an atom are not split,
+// since only the voxels outside of all atoms are added to the tree. the bottom level subvoxels use the
+// candidates of their parent, which saves building a list for each of them. the octree is descended along,
+// until a leaf is reached, whose cavity is passed on to all voxels within. vxl is NULL below the leaf
+void CavityTree::evalVxl(Space& cell, const std::array<unsigned,3>& index, const int lvl, const Vector& pos, const CandidateAtoms& candidates, const Voxel* vxl, CavityID cavity){
+  if (vxl != NULL && !vxl->hasSubvoxel()){
+    cavity = getLeafCavity(cell, index, lvl, *vxl);
+    vxl = NULL;
+  }
+  const double clearance = calcClearance(pos, candidates);
+  if (lvl == 0){
+    _clearance[offset(index)] = std::min(clearance, double(std::numeric_limits<float>::max()));
+    _cavity[offset(index)] = cavity;
+    return;
+  }
+  if (clearance < -_rad_vxl[lvl]){
+    fillVxl(index, lvl, clearance + _rad_vxl[lvl], 0);
+    return;
+  }
+  const double sub_dist = std::sqrt(3.0) * _grid_size * std::pow(2,lvl-2);
+  const double range = clearance + sub_dist + 2*_rad_vxl[lvl-1] + s_candidate_margin;
+  PooledBuffer<CandidateAtoms> sub_candidates;
+  for (unsigned i = 0; i < 8; ++i){
+    std::array<unsigned,3> sub_index;
+    Vector factors;
+    for (char dim = 0; dim < 3; ++dim){
+      const char j = (i >> dim) & 1;
+      sub_index[dim] = index[dim]*2 + j;
+      factors[dim] = j ? 1 : -1;
+    }
+    const Vector sub_pos = pos + factors * _grid_size * std::pow(2,lvl-2);
+    const Voxel* sub_vxl = (vxl != NULL)? &cell.getVxlFromGrid(sub_index, lvl-1) : NULL;
+    if (lvl == 1){
+      _clearance[offset(sub_index)] = std::min(calcClearance(sub_pos, candidates), double(std::numeric_limits<float>::max()));
+      _cavity[offset(sub_index)] = (sub_vxl != NULL)? getLeafCavity(cell, sub_index, lvl-1, *sub_vxl) : cavity;
+      continue;
+    }
+    sub_candidates->clear();
+    for (int k = 0; k < candidates.size(); ++k){
+      if ((sub_pos-candidates.getPos(k)) < range + candidates.rad[k]){sub_candidates->add(candidates.getPos(k), candidates.rad[k]);}
+    }
+    evalVxl(cell, sub_index, lvl-1, sub_pos, *sub_candidates, sub_vxl, cavity);
+  }
+}
+
+// sets the clearance and cavity of all bottom level voxels within the voxel
+void CavityTree::fillVxl(const std::array<unsigned,3>& index, const int lvl, const float clearance, const CavityID cavity){
+  const unsigned edge = 1u << lvl;
+  std::array<unsigned,3> row;
+  for (row[2] = index[2]*edge; row[2] < (index[2]+1)*edge; ++row[2]){
+    for (row[1] = index[1]*edge; row[1] < (index[1]+1)*edge; ++row[1]){
+      row[0] = index[0]*edge;
+      std::fill_n(_clearance.begin() + offset(row), edge, clearance);
+      std::fill_n(_cavity.begin() + offset(row), edge, cavity);
+    }
+  }
+}
+
+///////////
+// MERGE //
+///////////
+
+// the cavities are the elements 1..max_id of the union-find, followed by the voxels outside of the cavities
+// and outside of all atoms, in order of decreasing clearance. each voxel is merged with the touching elements
+// added before, including along edges and at corners like the cavities themselves. each region keeps the
+// oldest cavity it contains. when two regions with different cavities meet, the younger cavity, i.e. the one
+// born at the smaller clearance, records the merge. regions without a cavity, e.g. the space of the large probe
+// in the two probe mode, are absorbed silently, so that they never decide which cavity is the elder one. the
+// space of the large probe itself is left out, since it separates the cavities of any small probe. stops
+// as soon as all cavities have merged. throws if the voxels do not fit into the union-find
+void CavityTree::build(std::vector<Cavity>& cavities){
+  if (cavities.empty()){return;}
+  CavityID max_id = 0;
+  for (const Cavity& cav : cavities){
+    max_id = std::max(max_id, cav.id);
+  }
+  std::vector<Cavity*> cavity_of_id(max_id+1, NULL);
+  for (Cavity& cav : cavities){
+    cavity_of_id[cav.id] = &cav;
+  }
+
+  // a cavity is born at its voxel with the largest clearance, the first one in scan order if there are several
+  std::vector<float> birth(max_id+1, -std::numeric_limits<float>::max());
+  std::vector<std::pair<float,unsigned long>> order;
+  for (unsigned long i = 0; i < _clearance.size(); ++i){
+    const bool masked = _cavity[i] == s_masked;
+    if (_cavity[i] > max_id || cavity_of_id[_cavity[i]] == NULL){_cavity[i] = 0;}
+    const CavityID id = _cavity[i];
+    if (masked){continue;}
+    if (id == 0){
+      if (_clearance[i] >= 0){order.push_back({_clearance[i], i});}
+      continue;
+    }
+    if (_clearance[i] > birth[id]){
+      birth[id] = _clearance[i];
+      cavity_of_id[id]->max_probe = _clearance[i];
+      const std::array<unsigned long,3> index = {i % _n_vxl[0], (i / _n_vxl[0]) % _n_vxl[1], i / (_n_vxl[0]*_n_vxl[1])};
+      for (char dim = 0; dim < 3; ++dim){
+        cavity_of_id[id]->max_probe_pos[dim] = _origin[dim] + _grid_size * (0.5 + index[dim]);
+      }
+    }
+  }
+  std::vector<float>().swap(_clearance); // only the sorted voxels are needed from here on
+  if (max_id + 1 + order.size() >= std::numeric_limits<UnionFind::Element>::max()){
+    throw std::overflow_error("Too many voxels for the cavity merge tree!");
+  }
+  // voxels with the same clearance are added in scan order. the clearance is sorted along with the voxels, so
+  // that the sort does not jump through the whole grid
+  std::sort(order.begin(), order.end(), [](const auto& a, const auto& b){
+    return a.first > b.first || (a.first == b.first && a.second < b.second);
+  });
+  const UnionFind::Element first_vxl = max_id + 1;
+  const UnionFind::Element none = std::numeric_limits<UnionFind::Element>::max();
+  std::vector<UnionFind::Element> element_of_vxl(_cavity.size(), none);
+  for (UnionFind::Element k = 0; k < order.size(); ++k){
+    element_of_vxl[order[k].second] = first_vxl + k;
+  }
+
+  const UnionFind::Element n_elements = first_vxl + order.size();
+  UnionFind regions(n_elements);
+  std::vector<CavityID> region_cavity(n_elements, 0); // per root
+  auto getBirth = [&](const UnionFind::Element e){
+    return (e < first_vxl)? birth[e] : order[e - first_vxl].first;
+  };
+  auto isOlder = [&](const UnionFind::Element a, const UnionFind::Element b){
+    return getBirth(a) > getBirth(b) || (getBirth(a) == getBirth(b) && a < b);
+  };
+  size_t n_merges = 0;
+  auto merge = [&](const UnionFind::Element a, const UnionFind::Element b, const float clearance){
+    UnionFind::Element root_a = regions.find(a);
+    UnionFind::Element root_b = regions.find(b);
+    if (root_a == root_b){return;}
+    CavityID cav_a = region_cavity[root_a];
+    CavityID cav_b = region_cavity[root_b];
+    if (cav_a != 0 && cav_b != 0 && cav_a != cav_b){
+      if (isOlder(cav_b, cav_a)){std::swap(cav_a, cav_b);}
+      // cavity a is the elder one
+      cavity_of_id[cav_b]->merge_id = cav_a;
+      cavity_of_id[cav_b]->merge_probe = clearance;
+      n_merges++;
+    }
+    const CavityID cav = (cav_a != 0)? cav_a : cav_b;
+    regions.unite(root_a, root_b);
+    region_cavity[regions.find(root_a)] = cav;
+  };
+
+  // a cavity is added at its birth. voxels outside of the cavities may still have a larger clearance, where the
+  // types of the octree and the clearance of the bottom level voxel centres disagree. voxels touching a cavity
+  // before its birth are merged with it at its birth
+  std::vector<CavityID> cavity_order;
+  for (CavityID id = 1; id <= max_id; ++id){
+    if (cavity_of_id[id] != NULL){cavity_order.push_back(id);}
+  }
+  std::sort(cavity_order.begin(), cavity_order.end(), isOlder);
+  std::vector<bool> born(max_id+1, false);
+  std::vector<std::vector<UnionFind::Element>> pending(max_id+1);
+  size_t n_born = 0;
+  auto addCavities = [&](const float clearance){
+    for (; n_born < cavity_order.size() && birth[cavity_order[n_born]] >= clearance; ++n_born){
+      const CavityID id = cavity_order[n_born];
+      born[id] = true;
+      region_cavity[id] = id;
+      for (const UnionFind::Element e : pending[id]){
+        merge(id, e, birth[id]);
+      }
+      std::vector<UnionFind::Element>().swap(pending[id]);
+    }
+  };
+
+  for (UnionFind::Element k = 0; k < order.size() && n_merges+1 < cavities.size(); ++k){
+    const float clearance = order[k].first;
+    const unsigned long vxl = order[k].second;
+    const UnionFind::Element element = first_vxl + k;
+    addCavities(clearance);
+    const std::array<long,3> index = {long(vxl % _n_vxl[0]), long((vxl / _n_vxl[0]) % _n_vxl[1]), long(vxl / (_n_vxl[0]*_n_vxl[1]))};
+    std::array<long,3> nb_index;
+    for (nb_index[2] = index[2]-1; nb_index[2] <= index[2]+1; ++nb_index[2]){
+      for (nb_index[1] = index[1]-1; nb_index[1] <= index[1]+1; ++nb_index[1]){
+        for (nb_index[0] = index[0]-1; nb_index[0] <= index[0]+1; ++nb_index[0]){
+          bool in_bounds = true;
+          for (char dim = 0; dim < 3; ++dim){
+            in_bounds &= nb_index[dim] >= 0 && nb_index[dim] < long(_n_vxl[dim]);
+          }
+          if (!in_bounds){continue;}
+          const unsigned long nb = (nb_index[2]*_n_vxl[1] + nb_index[1])*_n_vxl[0] + nb_index[0];
+          const CavityID nb_cavity = _cavity[nb];
+          if (nb_cavity != 0 && !born[nb_cavity]){
+            if (pending[nb_cavity].empty() || pending[nb_cavity].back() != element){pending[nb_cavity].push_back(element);}
+            continue;
+          }
+          const UnionFind::Element nb_element = (nb_cavity != 0)? nb_cavity : element_of_vxl[nb];
+          if (nb_element == none || nb_element >= element){continue;} // not added yet
+          merge(element, nb_element, clearance);
+        }
+      }
+    }
+  }
+  addCavities(-std::numeric_limits<float>::max());
+}
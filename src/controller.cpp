@@ -175,25 +175,21 @@ bool Ctrl::runCalculation(){
 }
 
 // for starting a calculation from the command line
+// with several small probe radii, the calculation is run for each of them in turn, as if started separately
 bool Ctrl::runCalculation(
-    const double probe_radius_s,
+    const std::vector<double>& probe_radii_s,
     const double probe_radius_l,
     const double grid_resolution,
     const std::string& structure_file_path,
     const std::string& elements_file_path,
     const std::string& output_dir_path,
     const int tree_depth,
-    const bool opt_include_hetatm,
-    const bool opt_unit_cell,
-    const bool opt_surface_area,
-    const bool opt_probe_mode,
-    const bool exp_report,
-    const bool exp_total_map,
-    const bool exp_cavity_maps,
+    const CalcOptions& options,
+    const CalcSwitches& switches,
     const unsigned display_flag){
   if(_current_calculation == NULL){_current_calculation = new Model();}
 
-  try{_current_calculation->readAtomsFromFile(structure_file_path, opt_include_hetatm);}
+  try{_current_calculation->readAtomsFromFile(structure_file_path, switches.include_hetatm);}
   catch (const ExceptInvalidInputFile& e){
     displayErrorMessage(102);
     return false;
@@ -210,37 +206,43 @@ bool Ctrl::runCalculation(
     return false;
   }
 
-  _current_calculation->setParameters(
-    structure_file_path,
-    output_dir_path,
-    opt_include_hetatm,
-    opt_unit_cell,
-    opt_surface_area,
-    opt_probe_mode,
-    probe_radius_s,
-    probe_radius_l,
-    grid_resolution,
-    tree_depth,
-    exp_report,
-    exp_total_map,
-    exp_cavity_maps,
-    _current_calculation->getRadiusMap(),
-    _current_calculation->listElementsInStructure());
-
-  CalcReportBundle data = _current_calculation->generateData();
-
-  updateStatus((data.success && !Ctrl::getInstance()->getAbortFlag())? "Calculation done." : "Calculation aborted.");
-
-  displayInput(data, display_flag);
-  displayResults(data, display_flag);
-
-  if (data.success){
-    // export if appropriate option is toggled
-    if(data.make_report){exportReport();}
-    if(data.make_full_map){exportSurfaceMap(false);}
-    if(data.make_cav_maps){exportSurfaceMap(true);}
+  bool success = true;
+  for (const double probe_radius_s : probe_radii_s){
+    _current_calculation->setParameters(
+      structure_file_path,
+      output_dir_path,
+      switches.include_hetatm,
+      switches.unit_cell,
+      switches.surface_areas,
+      switches.probe_mode,
+      probe_radius_s,
+      probe_radius_l,
+      grid_resolution,
+      tree_depth,
+      switches.export_report,
+      switches.export_total_map,
+      switches.export_cavity_maps,
+      _current_calculation->getRadiusMap(),
+      _current_calculation->listElementsInStructure());
+    _current_calculation->setOptions(options);
+
+    CalcReportBundle data = _current_calculation->generateData();
+
+    updateStatus((data.success && !Ctrl::getInstance()->getAbortFlag())? "Calculation done." : "Calculation aborted.");
+
+    displayInput(data, display_flag);
+    displayResults(data, display_flag);
+
+    if (data.success){
+      // export if appropriate option is toggled
+      if(data.make_report){exportReport();}
+      if(data.make_full_map){exportSurfaceMap(false);}
+      if(data.make_cav_maps){exportSurfaceMap(true);}
+    }
+    success = data.success;
+    if (!success){break;}
   }
-  return data.success;
+  return success;
 }
 
 ////////////////////////
@@ -450,6 +452,35 @@ void Ctrl::displayCavityList(CalcReportBundle& data, const unsigned display_flag
       }
       notifyUser("\n");
     }
+    if (data.options.cavity_tree){displayCavityTree(data);}
+  }
+}
+
+// the merge tree is only listed in the command line output
+void Ctrl::displayCavityTree(CalcReportBundle& data){
+  const int width = 20;
+  const std::wstring len_unit = L"(" + Symbol::angstrom() + L")";
+  std::string header[] = {"Cavity ID", "Largest Probe", "Merges Into", "Bottleneck Probe"};
+  std::wstring units[] = {L"", len_unit, L"", len_unit};
+  notifyUser("\n");
+  for (std::string elem : header){
+    notifyUser(field(width,elem));
+  }
+  notifyUser("\n");
+  for (std::wstring elem : units){
+    notifyUser(wfield(width,elem));
+  }
+  notifyUser("\n");
+  const std::map<CavityID,size_t> cavity_numbers = listCavityNumbers(data.cavities);
+  for (size_t i = 0; i < data.cavities.size(); ++i){
+    const Cavity& cav = data.cavities[i];
+    std::string values[] = {std::to_string(i+1), std::to_string(cav.max_probe),
+      (cav.merge_id != 0)? std::to_string(cavity_numbers.at(cav.merge_id)) : "-",
+      (cav.merge_id != 0)? std::to_string(cav.merge_probe) : "-"};
+    for (std::string elem : values){
+      notifyUser(field(width,elem));
+    }
+    notifyUser("\n");
   }
 }
 
@@ -552,6 +583,11 @@ bool Ctrl::getAbortFlag(){
   return _abort_calculation;
 }
 
+// the flag itself, for calculations that check it without going through the controller
+const std::atomic<bool>& Ctrl::getAbortSignal(){
+  return _abort_calculation;
+}
+
 // checks whether worker thread has received a signal to stop the calculation and
 // updates the progress of the calculation
 void Ctrl::updateCalculationStatus(){
@@ -585,7 +621,8 @@ static const std::map<int, std::string> s_error_codes = {
   {115, "Invalid option(s). You may have selected an option that is incompatible with the structure file format."},
   // 2xx: Issue during Calculation
   {200, "Calculation failed!"},
-  {201, "Total number of cavities (255) exceeded. Consider changing the probe size. Calculation will proceed."},
+  {201, "Too many probe core leaves (core voxels without subvoxels) for 32-bit cavity IDs. Cavities were not identified. Consider a larger grid step or a different probe size. Calculation will proceed."},
+  {202, "Too many voxels for the cavity merge tree. Consider a larger grid step. Calculation will proceed without merges."},
   // 3xx: Issue with Output
   {300, "Output failed!"},
   {301, "Data missing to export file. Calculation may be still running or has not been started."},
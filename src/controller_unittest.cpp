@@ -3,8 +3,23 @@
 #include "atom.h" // i don't know why
 #include "model.h"
 #include "misc.h"
+#include "container3d.h"
+#include "voxel.h"
+#include "space.h"
+#include "atomtree.h"
+#include "flatatomtree.h"
+#include "atomindex.h"
+#include "coredistance.h"
+#include "threadpool.h"
+#include "subvoxelkernel.h"
+#include "pooledbuffer.h"
 #include <cmath>
 #include <map>
+#include <chrono>
+#include <stdexcept>
+#include <new>
+#include <limits>
+#include <thread>
 
 bool Ctrl::unittestExcluded(){
   if(_current_calculation == NULL){_current_calculation = new Model();}
@@ -320,3 +335,808 @@ bool Ctrl::unittestFloodfill(){
   }
   return true;
 }
+
+#define STRINGIFY_MACRO(x) #x
+#define STRINGIFY(x) STRINGIFY_MACRO(x)
+
+// visits all bottom level voxels below a voxel depth first, like the type assignment does
+template <class Layout>
+static unsigned long visitOctree(Container3D<Voxel,Layout>& grid, const std::array<unsigned long,3>& index, const int lvl){
+  if (lvl == 0){return grid.getElement(index).getType();}
+  unsigned long sum = 0;
+  for (char i = 0; i < 8; ++i){
+    sum += visitOctree(grid, {index[0]*2 + (i&1), index[1]*2 + ((i>>1)&1), index[2]*2 + ((i>>2)&1)}, lvl-1);
+  }
+  return sum;
+}
+
+// value of the voxel with the row-major index i. varied enough that a layout which maps two voxels to the same
+// element is caught
+static char layoutTestType(const unsigned long i){
+  return (i*37 + i/101) % 127;
+}
+
+struct LayoutChecksums{
+  unsigned long n_wrong = 0; // voxels that do not read back the value written to them
+  unsigned long octree = 0;
+  unsigned long stencil = 0;
+};
+
+// times two access patterns on a bottom level grid: depth first traversal of the octree (type assignment)
+// and the 2x2x2 stencil of the marching cubes (surface area). the grid is written through the row-major index
+// and read through coordinates, so that every layout must give the same checksums
+template <class Layout>
+static LayoutChecksums benchmarkLayout(const char* name, const std::array<unsigned long,3>& n, const int max_depth){
+  Container3D<Voxel,Layout> grid(n);
+  for (unsigned long i = 0; i < n[0]*n[1]*n[2]; ++i){
+    grid.getElement(i).setType(layoutTestType(i));
+  }
+  LayoutChecksums checksums;
+  for (unsigned long z = 0; z < n[2]; ++z){
+    for (unsigned long y = 0; y < n[1]; ++y){
+      for (unsigned long x = 0; x < n[0]; ++x){
+        if (grid.getElement(x, y, z).getType() != layoutTestType(x + n[0]*(y + n[1]*z))){checksums.n_wrong++;}
+      }
+    }
+  }
+
+  auto start = std::chrono::steady_clock::now();
+  std::array<unsigned long,3> top;
+  for (top[2] = 0; top[2] < (n[2] >> max_depth); ++top[2]){
+    for (top[1] = 0; top[1] < (n[1] >> max_depth); ++top[1]){
+      for (top[0] = 0; top[0] < (n[0] >> max_depth); ++top[0]){
+        checksums.octree += visitOctree(grid, top, max_depth);
+      }
+    }
+  }
+  auto mid = std::chrono::steady_clock::now();
+  for (unsigned long z = 0; z+1 < n[2]; ++z){
+    for (unsigned long y = 0; y+1 < n[1]; ++y){
+      for (unsigned long x = 0; x+1 < n[0]; ++x){
+        unsigned char config = 0;
+        for (char i = 0; i < 8; ++i){
+          config |= (grid.getElement(x + (i&1), y + ((i>>1)&1), z + ((i>>2)&1)).getType() % 3 == 0) << i;
+        }
+        checksums.stencil += config;
+      }
+    }
+  }
+  auto end = std::chrono::steady_clock::now();
+
+  printf("%16s: Octree: %10.5f s (checksum %lu), Stencil: %10.5f s (checksum %lu), wrong voxels: %lu\n", name,
+      std::chrono::duration<double>(mid-start).count(), checksums.octree,
+      std::chrono::duration<double>(end-mid).count(), checksums.stencil, checksums.n_wrong);
+  return checksums;
+}
+
+// a layout is correct, if no voxel is lost and it gives the same checksums as the row-major layout
+static bool compareLayout(const LayoutChecksums& layout, const LayoutChecksums& row_major){
+  return layout.n_wrong == 0 && layout.octree == row_major.octree && layout.stencil == row_major.stencil;
+}
+
+bool Ctrl::unittestLayout(){
+  if(_current_calculation == NULL){_current_calculation = new Model();}
+
+  // parameters for unittest:
+  const std::string atom_filepath = getResourcesDir() + "/Pd6L4_open_cage_Fujita.xyz";
+  const std::string elem_filepath = Ctrl::getDefaultElemPath();
+  const double grid_step = 0.1;
+  const int max_depth = 4;
+  const double rad_probe1 = 1.2;
+
+  CalcReportBundle data;
+  _current_calculation->readAtomsFromFile(atom_filepath, false);
+  std::vector<std::string> included_elements = _current_calculation->listElementsInStructure();
+
+  _current_calculation->setParameters(
+      atom_filepath,
+      "./output",
+      false,
+      false,
+      true,
+      false,
+      rad_probe1,
+      0,
+      grid_step,
+      max_depth,
+      false,
+      false,
+      false,
+      _current_calculation->extractRadiusMap(elem_filepath),
+      included_elements);
+
+  data = _current_calculation->generateData();
+  if(data.success){
+    printf("f: %40s, g: %4.1f, d: %4i, r: %4.1f\n", atom_filepath.c_str(), grid_step, max_depth, rad_probe1);
+    printf("Layout: %s\n", STRINGIFY(GRID_LAYOUT));
+    printf("Type Assignment: %10.5f s, Volume Tally: %10.5f s, Surface: %10.5f s\n", data.getTime(1), data.getTime(2), data.getTime(3));
+  }
+  else{
+    std::cout << "Calculation failed" << std::endl;
+    return false;
+  }
+
+  // same access patterns for all layouts on a grid that is not a power of 2 in size
+  const std::array<unsigned long,3> n = {208, 224, 256};
+  const LayoutChecksums row_major = benchmarkLayout<LayoutRowMajor>("Row-major", n, max_depth);
+  const bool morton = compareLayout(benchmarkLayout<LayoutMorton>("Morton", n, max_depth), row_major);
+  const bool bricked = compareLayout(benchmarkLayout<LayoutBricked<3>>("Bricked 8^3", n, max_depth), row_major);
+  printf("Morton same as row-major: %s\n", morton? "yes" : "no");
+  printf("Bricked same as row-major: %s\n", bricked? "yes" : "no");
+  return row_major.n_wrong == 0 && morton && bricked;
+}
+
+// counts the atoms within range of a point with the recursive search through the pointer based tree
+static unsigned long countInAtomTree(const AtomTree& tree, const AtomNode* node, const Vector& point, const double range){
+  if (node == NULL || node->isOutOfRange(point, range)){return 0;}
+  const Atom& atom = tree.getAtom(node);
+  const unsigned long n_atoms = ((point-atom.getPosVec()) < range + atom.getRad())? 1 : 0;
+  return n_atoms
+    + countInAtomTree(tree, node->getLeftChild(), point, range)
+    + countInAtomTree(tree, node->getRightChild(), point, range);
+}
+
+// the same queries as during the type assignment: for points spread over the whole structure, count the
+// atoms within range of a voxel and the probe
+bool Ctrl::unittestAtomTree(){
+  if(_current_calculation == NULL){_current_calculation = new Model();}
+
+  // parameters for unittest:
+  const std::string atom_filepath = getResourcesDir() + "/Pd6L4_open_cage_Fujita.xyz";
+  const std::string elem_filepath = Ctrl::getDefaultElemPath();
+  const double grid_step = 0.1;
+  const int max_depth = 4;
+  const double rad_probe1 = 1.2;
+  const double query_step = 0.2;
+
+  CalcReportBundle data;
+  _current_calculation->readAtomsFromFile(atom_filepath, false);
+  std::vector<std::string> included_elements = _current_calculation->listElementsInStructure();
+
+  _current_calculation->setParameters(
+      atom_filepath,
+      "./output",
+      false,
+      false,
+      true,
+      false,
+      rad_probe1,
+      0,
+      grid_step,
+      max_depth,
+      false,
+      false,
+      false,
+      _current_calculation->extractRadiusMap(elem_filepath),
+      included_elements);
+
+  data = _current_calculation->generateData();
+  if(!data.success){
+    std::cout << "Calculation failed" << std::endl;
+    return false;
+  }
+  printf("f: %40s, g: %4.1f, d: %4i, r: %4.1f\n", atom_filepath.c_str(), grid_step, max_depth, rad_probe1);
+  printf("Type Assignment: %10.5f s\n", data.getTime(1));
+
+  const std::vector<Atom>& atoms = _current_calculation->getAtomList();
+  auto start = std::chrono::steady_clock::now();
+  const AtomTree tree(atoms);
+  auto mid = std::chrono::steady_clock::now();
+  const FlatAtomTree flat_tree(atoms);
+  auto end = std::chrono::steady_clock::now();
+  printf("Build: AtomTree: %10.5f s, FlatAtomTree: %10.5f s\n",
+      std::chrono::duration<double>(mid-start).count(), std::chrono::duration<double>(end-mid).count());
+
+  // query points on a grid around all atoms
+  Vector min = atoms[0].getPosVec();
+  Vector max = atoms[0].getPosVec();
+  for (const Atom& atom : atoms){
+    for (char dim = 0; dim < 3; ++dim){
+      min[dim] = std::min(min[dim], atom.getCoordinate(dim) - 2*rad_probe1);
+      max[dim] = std::max(max[dim], atom.getCoordinate(dim) + 2*rad_probe1);
+    }
+  }
+  std::vector<Vector> points;
+  for (double x = min[0]; x < max[0]; x += query_step){
+    for (double y = min[1]; y < max[1]; y += query_step){
+      for (double z = min[2]; z < max[2]; z += query_step){
+        points.push_back(Vector(x,y,z));
+      }
+    }
+  }
+  const double range = rad_probe1 + grid_step;
+  unsigned long checksum = 0;
+  start = std::chrono::steady_clock::now();
+  for (const Vector& point : points){
+    checksum += countInAtomTree(tree, tree.getRoot(), point, range);
+  }
+  mid = std::chrono::steady_clock::now();
+  unsigned long flat_checksum = 0;
+  for (const Vector& point : points){
+    flat_tree.forEachAtomInRange(point, range, [&](const Vector& pos_atom, const double rad_atom){
+      flat_checksum += ((point-pos_atom) < range + rad_atom)? 1 : 0;
+      return false;
+    });
+  }
+  end = std::chrono::steady_clock::now();
+  printf("%lu queries: AtomTree: %10.5f s (checksum %lu), FlatAtomTree: %10.5f s (checksum %lu)\n", points.size(),
+      std::chrono::duration<double>(mid-start).count(), checksum, std::chrono::duration<double>(end-mid).count(), flat_checksum);
+  return checksum == flat_checksum;
+}
+
+// range queries on a grid of points around the atoms with both engines. the number of atoms found within
+// range has to be the same
+static bool benchmarkAtomIndex(const char* name, const std::vector<Atom>& atoms, const double r_probe, const double query_step){
+  auto start = std::chrono::steady_clock::now();
+  const AtomIndex tree(atoms, AtomIndex::Tree, r_probe);
+  auto mid = std::chrono::steady_clock::now();
+  const AtomIndex cell_list(atoms, AtomIndex::CellList, r_probe);
+  auto end = std::chrono::steady_clock::now();
+  printf("%s, %lu atoms. Build: Tree: %10.5f s, Cell list: %10.5f s\n", name, atoms.size(),
+      std::chrono::duration<double>(mid-start).count(), std::chrono::duration<double>(end-mid).count());
+
+  Vector min = atoms[0].getPosVec();
+  Vector max = atoms[0].getPosVec();
+  for (const Atom& atom : atoms){
+    for (char dim = 0; dim < 3; ++dim){
+      min[dim] = std::min(min[dim], atom.getCoordinate(dim) - 2*r_probe);
+      max[dim] = std::max(max[dim], atom.getCoordinate(dim) + 2*r_probe);
+    }
+  }
+  std::vector<Vector> points;
+  for (double x = min[0]; x < max[0]; x += query_step){
+    for (double y = min[1]; y < max[1]; y += query_step){
+      for (double z = min[2]; z < max[2]; z += query_step){
+        points.push_back(Vector(x,y,z));
+      }
+    }
+  }
+  const double range = r_probe + query_step;
+  std::array<unsigned long,2> checksum = {0,0};
+  std::array<double,2> time;
+  for (int engine = 0; engine < 2; ++engine){
+    const AtomIndex& index = (engine == 0)? tree : cell_list;
+    start = std::chrono::steady_clock::now();
+    for (const Vector& point : points){
+      index.forEachAtomInRange(point, range, [&](const Vector& pos_atom, const double rad_atom){
+        checksum[engine] += ((point-pos_atom) < range + rad_atom)? 1 : 0;
+        return false;
+      });
+    }
+    end = std::chrono::steady_clock::now();
+    time[engine] = std::chrono::duration<double>(end-start).count();
+  }
+  printf("%lu queries: Tree: %10.5f s (checksum %lu), Cell list: %10.5f s (checksum %lu)\n",
+      points.size(), time[0], checksum[0], time[1], checksum[1]);
+  return checksum[0] == checksum[1];
+}
+
+// compares the atom tree and the cell list: the full calculation on a protein, and atom queries alone on the
+// protein and on a supercell of 3x3x3 copies of it
+bool Ctrl::unittestAtomIndex(){
+  if(_current_calculation == NULL){_current_calculation = new Model();}
+
+  // parameters for unittest:
+  const std::string atom_filepath = getResourcesDir() + "/6s8y.xyz";
+  const std::string elem_filepath = Ctrl::getDefaultElemPath();
+  const double grid_step = 0.2;
+  const int max_depth = 4;
+  const double rad_probe1 = 1.2;
+
+  _current_calculation->readAtomsFromFile(atom_filepath, false);
+  std::vector<std::string> included_elements = _current_calculation->listElementsInStructure();
+
+  _current_calculation->setParameters(
+      atom_filepath,
+      "./output",
+      false,
+      false,
+      true,
+      false,
+      rad_probe1,
+      0,
+      grid_step,
+      max_depth,
+      false,
+      false,
+      false,
+      _current_calculation->extractRadiusMap(elem_filepath),
+      included_elements);
+
+  printf("f: %40s, g: %4.1f, d: %4i, r: %4.1f\n", atom_filepath.c_str(), grid_step, max_depth, rad_probe1);
+  std::array<CalcReportBundle,2> data;
+  for (int engine = 0; engine < 2; ++engine){
+    _current_calculation->setCellList(engine == 1);
+    data[engine] = _current_calculation->generateData();
+    if(!data[engine].success){
+      std::cout << "Calculation failed" << std::endl;
+      return false;
+    }
+    printf("%10s: Type Assignment: %10.5f s\n", (engine == 0)? "Tree" : "Cell list", data[engine].getTime(1));
+  }
+  _current_calculation->setCellList(false);
+  bool success = data[0].volumes == data[1].volumes;
+
+  const std::vector<Atom> atoms = _current_calculation->getAtomList();
+  success &= benchmarkAtomIndex("6s8y", atoms, rad_probe1, 0.2);
+
+  // copies of the protein side by side, as in a crystal
+  Vector min = atoms[0].getPosVec();
+  Vector max = atoms[0].getPosVec();
+  for (const Atom& atom : atoms){
+    for (char dim = 0; dim < 3; ++dim){
+      min[dim] = std::min(min[dim], atom.getCoordinate(dim));
+      max[dim] = std::max(max[dim], atom.getCoordinate(dim));
+    }
+  }
+  const Vector shift = max - min;
+  std::vector<Atom> supercell;
+  for (int i = 0; i < 27; ++i){
+    for (Atom atom : atoms){
+      atom.pos_x += shift[0] * (i%3);
+      atom.pos_y += shift[1] * ((i/3)%3);
+      atom.pos_z += shift[2] * (i/9);
+      supercell.push_back(atom);
+    }
+  }
+  success &= benchmarkAtomIndex("6s8y 3x3x3", supercell, rad_probe1, 0.4);
+  return success;
+}
+
+// compares the distance transform with the squared distance to the closest core voxel found by brute force
+static bool checkCoreDistanceMap(const std::array<unsigned long,3>& n, const unsigned n_cores){
+  std::vector<std::array<unsigned,3>> cores;
+  unsigned seed = 1;
+  auto random = [&seed](const unsigned long max){
+    seed = seed * 1103515245 + 12345;
+    return (unsigned)((seed >> 8) % max);
+  };
+  for (unsigned i = 0; i < n_cores; ++i){
+    cores.push_back({random(n[0]), random(n[1]), random(n[2])});
+  }
+  CoreDistanceMap map(std::vector<std::array<unsigned long,3>>{n});
+  std::array<unsigned,3> index;
+  for (index[2] = 0; index[2] < n[2]; ++index[2]){
+    for (index[1] = 0; index[1] < n[1]; ++index[1]){
+      for (index[0] = 0; index[0] < n[0]; ++index[0]){
+        map.setCore(index, 0, false);
+      }
+    }
+  }
+  for (const std::array<unsigned,3>& core : cores){
+    map.setCore(core, 0, true);
+  }
+  for (char dim = 0; dim < 3; ++dim){
+    map.transformLines(0, dim, 0, map.getNumLines(0, dim));
+  }
+  unsigned long n_wrong = 0;
+  for (index[2] = 0; index[2] < n[2]; ++index[2]){
+    for (index[1] = 0; index[1] < n[1]; ++index[1]){
+      for (index[0] = 0; index[0] < n[0]; ++index[0]){
+        CoreDistanceMap::Dist min_dist = CoreDistanceMap::s_inf;
+        for (const std::array<unsigned,3>& core : cores){
+          CoreDistanceMap::Dist dist = 0;
+          for (char i = 0; i < 3; ++i){
+            const long diff = long(index[i]) - long(core[i]);
+            dist += diff*diff;
+          }
+          min_dist = std::min(min_dist, dist);
+        }
+        if (map.getSquaredDist(index, 0) != min_dist){n_wrong++;}
+      }
+    }
+  }
+  printf("Distance transform %lux%lux%lu, %u cores: %lu wrong distances\n", n[0], n[1], n[2], n_cores, n_wrong);
+  return n_wrong == 0;
+}
+
+bool Ctrl::unittestDistanceTransform(){
+  if(_current_calculation == NULL){_current_calculation = new Model();}
+
+  // parameters for unittest:
+  const std::string atom_filepath = getResourcesDir() + "/Pd6L4_open_cage_Fujita.xyz";
+  const std::string elem_filepath = Ctrl::getDefaultElemPath();
+  const double grid_step = 0.2;
+  const int max_depth = 4;
+  const double rad_probe1 = 1.2;
+  const double rad_probe2 = 4;
+
+  _current_calculation->readAtomsFromFile(atom_filepath, false);
+  std::vector<std::string> included_elements = _current_calculation->listElementsInStructure();
+
+  _current_calculation->setParameters(
+      atom_filepath,
+      "./output",
+      false,
+      false,
+      true,
+      true,
+      rad_probe1,
+      rad_probe2,
+      grid_step,
+      max_depth,
+      false,
+      false,
+      false,
+      _current_calculation->extractRadiusMap(elem_filepath),
+      included_elements);
+
+  printf("f: %40s, g: %4.1f, d: %4i, r: %4.1f, %4.1f\n", atom_filepath.c_str(), grid_step, max_depth, rad_probe1, rad_probe2);
+  std::array<CalcReportBundle,2> data;
+  for (int engine = 0; engine < 2; ++engine){
+    _current_calculation->setDistanceTransform(engine == 1);
+    data[engine] = _current_calculation->generateData();
+    if(!data[engine].success){
+      std::cout << "Calculation failed" << std::endl;
+      return false;
+    }
+    printf("%18s: Type Assignment: %10.5f s\n", (engine == 0)? "Neighbour search" : "Distance transform", data[engine].getTime(1));
+  }
+  _current_calculation->setDistanceTransform(false);
+  bool success = data[0].volumes == data[1].volumes;
+  success &= data[0].cavities.size() == data[1].cavities.size();
+  for (size_t i = 0; success && i < data[0].cavities.size(); ++i){
+    success &= data[0].cavities[i].shell_vol == data[1].cavities[i].shell_vol;
+  }
+  printf("Same results: %s\n", success? "yes" : "no");
+
+  success &= checkCoreDistanceMap({37, 20, 29}, 1);
+  success &= checkCoreDistanceMap({37, 20, 29}, 25);
+  success &= checkCoreDistanceMap({16, 16, 16}, 0);
+  return success;
+}
+
+// the cavities of a smaller probe follow from the merge tree of a larger one. the cavities of the smaller probe
+// are either cavities of the larger probe that did not merge above the smaller radius, or are born below the
+// larger radius
+bool Ctrl::unittestCavityTree(){
+  if(_current_calculation == NULL){_current_calculation = new Model();}
+
+  // parameters for unittest:
+  const std::string atom_filepath = getResourcesDir() + "/6s8y.xyz";
+  const std::string elem_filepath = Ctrl::getDefaultElemPath();
+  const double grid_step = 0.2;
+  const int max_depth = 4;
+  const std::vector<double> rad_probes = {1.2, 1.0};
+  // the large probe has a larger clearance than any cavity, which must not decide the elder of two cavities
+  const std::vector<double> rad_large_probes = {0, 3};
+
+  _current_calculation->readAtomsFromFile(atom_filepath, false);
+  std::vector<std::string> included_elements = _current_calculation->listElementsInStructure();
+
+  bool success = true;
+  _current_calculation->setCavityTree(true);
+  for (const double rad_large_probe : rad_large_probes){
+    const bool probe_mode = rad_large_probe > 0;
+    printf("f: %40s, g: %4.1f, d: %4i, r: %4.1f, %4.1f, r2: %4.1f\n", atom_filepath.c_str(), grid_step, max_depth, rad_probes[0], rad_probes[1], rad_large_probe);
+    std::array<CalcReportBundle,2> data;
+    for (int i = 0; i < 2; ++i){
+      _current_calculation->setParameters(
+          atom_filepath,
+          "./output",
+          false,
+          false,
+          false,
+          probe_mode,
+          rad_probes[i],
+          rad_large_probe,
+          grid_step,
+          max_depth,
+          false,
+          false,
+          false,
+          _current_calculation->extractRadiusMap(elem_filepath),
+          included_elements);
+      data[i] = _current_calculation->generateData();
+      if(!data[i].success){
+        std::cout << "Calculation failed" << std::endl;
+        _current_calculation->setCavityTree(false);
+        return false;
+      }
+    }
+
+    // every cavity merges into a cavity that was born at a larger probe
+    std::map<CavityID,double> max_probe;
+    for (const Cavity& cav : data[0].cavities){
+      max_probe[cav.id] = cav.max_probe;
+    }
+    size_t n_merged = 0;
+    bool elder = true;
+    for (const Cavity& cav : data[0].cavities){
+      if (cav.merge_id == 0){continue;}
+      elder &= max_probe[cav.merge_id] >= cav.max_probe;
+      if (cav.merge_probe >= rad_probes[1]){n_merged++;}
+    }
+    size_t n_born = 0;
+    for (const Cavity& cav : data[1].cavities){
+      if (cav.max_probe < rad_probes[0]){n_born++;}
+    }
+    printf("Cavities: %zu, merged: %zu, born: %zu, cavities of the smaller probe: %zu\n", data[0].cavities.size(), n_merged, n_born, data[1].cavities.size());
+    const bool consistent = data[0].cavities.size() - n_merged + n_born == data[1].cavities.size();
+    printf("Merged into elder cavities: %s\n", elder? "yes" : "no");
+    printf("Consistent tree: %s\n", consistent? "yes" : "no");
+    success &= elder && consistent;
+  }
+  _current_calculation->setCavityTree(false);
+  return success;
+}
+
+// an exception thrown by a task or by a spawned subtask must reach the owner of the pool through waitForTasks,
+// instead of terminating the program. afterwards, the pool must be usable again
+static bool waitForFailure(ThreadPool& pool, const std::string& expected){
+  try {
+    while (!pool.waitForTasks(std::chrono::milliseconds(100))){}
+  }
+  catch (const std::bad_alloc& e){return expected == "bad_alloc";}
+  catch (const std::runtime_error& e){return expected == e.what();}
+  return expected.empty();
+}
+
+bool Ctrl::unittestThreadPool(){
+  ThreadPool pool(4);
+  std::atomic<unsigned> n_done(0);
+  for (unsigned i = 0; i < 100; ++i){
+    pool.submit([&n_done, i](){
+      if (i == 37){throw std::runtime_error("task");}
+      n_done++;
+    });
+  }
+  const bool task = waitForFailure(pool, "task");
+  printf("Exception of a task passed on: %s\n", task? "yes" : "no");
+
+  // the failing subtask is deep in the recursion, while the other subtasks keep running
+  std::function<void(const unsigned, const unsigned)> recurse = [&](const unsigned lvl, const unsigned i){
+    if (lvl == 0){
+      if (i == 5){throw std::bad_alloc();}
+      return;
+    }
+    ThreadPool::forkJoin(8, [&](const unsigned j){recurse(lvl-1, i*8 + j);});
+  };
+  pool.submit([&](){recurse(3, 0);});
+  const bool subtask = waitForFailure(pool, "bad_alloc");
+  printf("Exception of a spawned subtask passed on: %s\n", subtask? "yes" : "no");
+
+  n_done = 0;
+  for (unsigned i = 0; i < 100; ++i){
+    pool.submit([&n_done](){n_done++;});
+  }
+  const bool reusable = waitForFailure(pool, "") && n_done == 100;
+  printf("Pool usable afterwards: %s\n", reusable? "yes" : "no");
+  return task && subtask && reusable;
+}
+
+// a voxel is in the potential shell of one atom and touches the potential probe core of another. the type must
+// not depend on the order, in which the atoms are evaluated. mirroring the atoms along x reverses the order in
+// both atom indices
+static char evalTwoAtoms(const AtomIndex::Engine engine, const bool masking_mode, const bool mirrored){
+  const double sign = mirrored? -1 : 1;
+  std::vector<Atom> atoms;
+  atoms.push_back(Atom(sign*2.5, 0, 0, "C", 1, 6)); // shell
+  atoms.push_back(Atom(sign*-4, 0, 0, "C", 1, 6)); // touching core
+  const double rad_probe = 3;
+  Space cell;
+  SilentMonitor monitor;
+  CalcContext ctx(cell, atoms, engine, rad_probe, monitor);
+  // storeProbe would build the search indices for the shell vs void assignment, which needs a grid
+  ctx.r_probe = rad_probe;
+  ctx.masking_mode = masking_mode;
+  Voxel vxl;
+  vxl.traverseTree(ctx, Vector(0,0,0), 0.5, rad_probe, NULL);
+  return vxl.getType();
+}
+
+bool Ctrl::unittestAtomOrder(){
+  bool success = true;
+  for (const bool masking_mode : {false, true}){
+    const char expected = masking_mode? 0b01000000 : 0b00010000;
+    for (const AtomIndex::Engine engine : {AtomIndex::Tree, AtomIndex::CellList}){
+      const char type = evalTwoAtoms(engine, masking_mode, false);
+      const char type_mirrored = evalTwoAtoms(engine, masking_mode, true);
+      printf("%s probe, %s: type %4i, mirrored %4i\n", masking_mode? "Large" : "Small",
+          engine == AtomIndex::Tree? "atom tree" : "cell list", (unsigned char)type, (unsigned char)type_mirrored);
+      success &= type == expected && type_mirrored == expected;
+    }
+  }
+  printf("Potential shell kept in any order: %s\n", success? "yes" : "no");
+  return success;
+}
+
+// counts the status reports, to check that they reach the monitor of their own calculation
+class CountingMonitor : public SilentMonitor{
+  public:
+    void updateStatus(std::string) override {n_status++;}
+    unsigned n_status = 0;
+};
+
+// the type assignment and volume tally of a ring of atoms with its own monitor
+static std::map<char,double> calcRingVolumes(CalcMonitor& monitor, bool& assigned){
+  std::vector<Atom> atoms;
+  for (int i = 0; i < 6; ++i){
+    atoms.push_back(Atom(1.4*std::cos(i*M_PI/3), 1.4*std::sin(i*M_PI/3), 0, "C", 1.7, 6));
+  }
+  Space cell(atoms, 0.1, 4, 1.2, false, {0,0,0}, 1, false, false, monitor);
+  bool cavities_exceeded = false;
+  cell.assignTypeInGrid(atoms, 1.2, 0, false, AtomIndex::Tree, false, cavities_exceeded);
+  std::map<char,double> volumes;
+  std::vector<Cavity> cavities;
+  cell.getVolume(volumes, cavities);
+  assigned = cell.getTopVxl(0).isAssigned();
+  return volumes;
+}
+
+// two calculations run side by side in one process, each with its own monitor. the aborted one must stop without
+// affecting the other, whose volumes must match those of a calculation on its own
+bool Ctrl::unittestCalcMonitor(){
+  CountingMonitor reference_monitor;
+  bool reference_assigned;
+  const std::map<char,double> reference = calcRingVolumes(reference_monitor, reference_assigned);
+
+  CountingMonitor monitor;
+  SilentMonitor aborted_monitor;
+  aborted_monitor.abort();
+  bool assigned, aborted_assigned;
+  std::map<char,double> volumes, aborted_volumes;
+  std::thread aborted_calc([&](){aborted_volumes = calcRingVolumes(aborted_monitor, aborted_assigned);});
+  std::thread calc([&](){volumes = calcRingVolumes(monitor, assigned);});
+  aborted_calc.join();
+  calc.join();
+
+  const bool same = reference_assigned && assigned && volumes == reference && monitor.n_status == reference_monitor.n_status;
+  printf("Status reports: %u, volumes same as alone: %s\n", monitor.n_status, same? "yes" : "no");
+  printf("Aborted calculation stopped: %s\n", !aborted_assigned? "yes" : "no");
+  return same && monitor.n_status > 0 && !aborted_assigned;
+}
+
+// the volume and surface calculation of a structure by a model with its own monitor
+static CalcReportBundle calcModelData(CalcMonitor& monitor, const std::string& atom_filepath){
+  Model model(monitor);
+  model.readAtomsFromFile(atom_filepath, false);
+  model.setParameters(
+      atom_filepath,
+      "./output",
+      false,
+      false,
+      true,
+      false,
+      1.2,
+      0,
+      0.1,
+      4,
+      false,
+      false,
+      false,
+      model.extractRadiusMap(Ctrl::getDefaultElemPath()),
+      model.listElementsInStructure());
+  CalcOptions options;
+  options.n_threads = 1; // the same order of the sums as the reference
+  model.setOptions(options);
+  return model.generateData();
+}
+
+// same as unittestCalcMonitor, but with two whole models: every report and abort check of a model, including
+// those of the surface calculation, must go to its own monitor and not to the controller
+bool Ctrl::unittestModelMonitor(){
+  const std::string atom_filepath = getResourcesDir() + "/probetest_triplet.xyz";
+  CountingMonitor reference_monitor;
+  const CalcReportBundle reference = calcModelData(reference_monitor, atom_filepath);
+
+  CountingMonitor monitor;
+  CountingMonitor aborted_monitor;
+  aborted_monitor.abort();
+  CalcReportBundle data, aborted_data;
+  std::thread aborted_calc([&](){aborted_data = calcModelData(aborted_monitor, atom_filepath);});
+  std::thread calc([&](){data = calcModelData(monitor, atom_filepath);});
+  aborted_calc.join();
+  calc.join();
+
+  const bool same = reference.success && data.success
+    && data.volumes == reference.volumes
+    && data.surf_molecular == reference.surf_molecular
+    && monitor.n_status == reference_monitor.n_status;
+  printf("Status reports: %u, results same as alone: %s\n", monitor.n_status, same? "yes" : "no");
+  printf("Aborted model stopped: %s\n", !aborted_data.success? "yes" : "no");
+  return same && monitor.n_status > 0 && !aborted_data.success;
+}
+
+// a buffer returned to the pool must keep its capacity and be handed out again, while buffers in use must never be
+// handed out twice. the latter is checked in a recursion through forkJoin, where waiting threads run other subtasks.
+// the leaves sleep, so that the subtasks are stolen while their parents wait. a buffer per recursion level and
+// thread instead of the pool fails this test
+bool Ctrl::unittestPooledBuffer(){
+  const std::vector<unsigned>* first;
+  {
+    PooledBuffer<std::vector<unsigned>> buffer;
+    buffer->assign(1000, 0);
+    first = buffer.get();
+  }
+  bool reused;
+  {
+    PooledBuffer<std::vector<unsigned>> buffer;
+    PooledBuffer<std::vector<unsigned>> nested;
+    PooledBuffer<std::vector<unsigned>> none(false);
+    reused = buffer.get() == first && buffer->capacity() >= 1000 && nested.get() != first && none.get() == NULL;
+  }
+  printf("Buffer reused with its capacity: %s\n", reused? "yes" : "no");
+
+  ThreadPool pool(4);
+  std::atomic<unsigned> n_overwritten(0);
+  std::function<void(const unsigned, const unsigned)> recurse = [&](const unsigned lvl, const unsigned id){
+    PooledBuffer<std::vector<unsigned>> buffer;
+    buffer->assign(8, id);
+    if (lvl == 0){std::this_thread::sleep_for(std::chrono::microseconds(20));}
+    else {
+      ThreadPool::forkJoin(8, [&](const unsigned j){recurse(lvl-1, id*8 + j + 1);});
+    }
+    for (unsigned k : *buffer){
+      if (k != id){
+        n_overwritten++;
+        break;
+      }
+    }
+  };
+  for (unsigned i = 0; i < 8; ++i){
+    pool.submit([&recurse, i](){recurse(3, i);});
+  }
+  while (!pool.waitForTasks(std::chrono::milliseconds(100))){}
+  printf("Buffers overwritten while in use: %u\n", n_overwritten.load());
+  return reused && n_overwritten == 0;
+}
+
+// places one atom per trial right at one of the limits of one subvoxel and compares the relations found by
+// classifySubvoxels with those found by comparing Vectors, like Voxel::isAtom does. compiled for AVX or
+// AVX-512, this checks that the vector instructions round the distances in the same way as Vector::squared
+bool Ctrl::unittestSubvoxelKernel(){
+#if defined(__AVX512F__)
+  printf("Instruction set: AVX-512\n");
+#elif defined(__AVX__)
+  printf("Instruction set: AVX\n");
+#else
+  printf("Instruction set: scalar\n");
+#endif
+  unsigned seed = 1;
+  auto random = [&seed](){
+    seed = seed * 1103515245 + 12345;
+    return (double)(seed >> 8) / (1 << 24);
+  };
+  const unsigned n_trials = 200000;
+  unsigned n_wrong = 0;
+  for (unsigned trial = 0; trial < n_trials; ++trial){
+    const double rad_sub = 0.025 * (1 + random());
+    const double rad_probe = (random() < 0.2)? 0 : 2 * random();
+    const double range = 2 * random();
+    const double rad_atom = (random() < 0.1)? 0.02 : 0.5 + 1.5 * random();
+    const Vector centre(20 * random() - 10, 20 * random() - 10, 20 * random() - 10);
+    std::array<Vector,8> pos_sub;
+    for (char i = 0; i < 8; ++i){
+      pos_sub[i] = centre + Vector((i&1)? rad_sub : -rad_sub, (i&2)? rad_sub : -rad_sub, (i&4)? rad_sub : -rad_sub);
+    }
+    const std::array<double,5> limits = {
+      rad_atom - rad_sub,
+      rad_atom + rad_sub,
+      rad_atom + rad_probe - rad_sub,
+      rad_atom + rad_probe + rad_sub,
+      range + rad_atom};
+    // the distance to the chosen subvoxel is off from the chosen limit by a few units in the last place at most
+    const double lim = std::abs(limits[trial % 5]);
+    const Vector dir = Vector(random() - 0.5, random() - 0.5, random() - 0.5).normalise();
+    const double offset = 1 + ((int)(trial % 7) - 3) * std::numeric_limits<double>::epsilon();
+    const Vector pos_atom = pos_sub[(trial / 5) % 8] + dir * (lim * offset);
+
+    CandidateAtoms candidates;
+    candidates.add(pos_atom, rad_atom);
+    std::array<AtomRelations,8> sub;
+    classifySubvoxels(candidates, pos_sub, rad_sub, rad_probe, range, 0xFF, true, sub);
+    for (char i = 0; i < 8; ++i){
+      const Vector dist = pos_sub[i] - pos_atom;
+      char relations = mvREL_NONE;
+      if (0 < limits[0] && dist < limits[0]){relations |= mvREL_INSIDE;}
+      if (dist < limits[1]){relations |= mvREL_PARTIAL;}
+      if (0 < limits[2] && dist < limits[2]){relations |= mvREL_SHELL;}
+      if (dist < limits[3]){relations |= mvREL_TOUCHING_CORE;}
+      const int n_collected = (dist < limits[4])? 1 : 0;
+      if (sub[i].relations != relations || sub[i].candidates.size() != n_collected){n_wrong++;}
+    }
+  }
+  printf("Subvoxels compared: %u, different from Vector comparison: %u\n", 8*n_trials, n_wrong);
+  return n_wrong == 0;
+}
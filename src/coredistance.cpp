@@ -0,0 +1,90 @@
+#include "coredistance.h"
+
+/////////////////
+// CONSTRUCTOR //
+/////////////////
+
+CoreDistanceMap::CoreDistanceMap(const std::vector<std::array<unsigned long,3>>& n_vxl) : _n_vxl(n_vxl) {
+  for (const std::array<unsigned long,3>& n : _n_vxl){
+    _dist.push_back(std::vector<Dist>(n[0]*n[1]*n[2], s_inf));
+  }
+}
+
+////////////////////////
+// DISTANCE TRANSFORM //
+////////////////////////
+
+// rounds towards negative infinity, unlike the integer division. the divisor must be positive
+static inline long floorDiv(const long num, const long div){
+  return num/div - ((num % div != 0) && (num < 0));
+}
+
+// replaces the values f(i) of one line by min_j((i-j)^2 + f(j)), the lower envelope of a set of parabolas.
+// the envelope is built with integer arithmetic only (meijster, roerdink & hesselink), so the squared
+// distances are exact. s holds the parabolas of the envelope and t the position from which each is lowest
+static void transformLine(const std::vector<long>& f, std::vector<long>& s, std::vector<long>& t, std::vector<long>& d){
+  const long n = f.size();
+  const long inf = CoreDistanceMap::s_inf;
+  auto parabola = [&](const long x, const long i){return (x-i)*(x-i) + f[i];};
+  // first position at which the parabola of u is lower than the parabola of i < u
+  auto separation = [&](const long i, const long u){return 1 + floorDiv(u*u - i*i + f[u] - f[i], 2*(u-i));};
+  long k = -1;
+  for (long u = 0; u < n; ++u){
+    if (f[u] == inf){continue;}
+    while (k >= 0 && parabola(t[k], s[k]) > parabola(t[k], u)){--k;}
+    if (k < 0){
+      k = 0;
+      s[0] = u;
+      t[0] = 0;
+    }
+    else {
+      const long w = separation(s[k], u);
+      if (w < n){
+        ++k;
+        s[k] = u;
+        t[k] = w;
+      }
+    }
+  }
+  // no core on this line or on any line it was combined with
+  if (k < 0){
+    d.assign(n, inf);
+    return;
+  }
+  for (long x = n-1; x >= 0; --x){
+    d[x] = parabola(x, s[k]);
+    if (x == t[k]){--k;}
+  }
+}
+
+unsigned long CoreDistanceMap::getNumLines(const int lvl, const char dim) const {
+  const std::array<unsigned long,3>& n = _n_vxl[lvl];
+  return n[0]*n[1]*n[2] / n[dim];
+}
+
+// transforms the lines [first,last) along dim. lines along x are numbered by y and z, lines along y by x and z,
+// and lines along z by x and y, with the first of the two coordinates running fastest
+void CoreDistanceMap::transformLines(const int lvl, const char dim, const unsigned long first, const unsigned long last){
+  const std::array<unsigned long,3>& n = _n_vxl[lvl];
+  const unsigned long stride = (dim == 0)? 1 : ((dim == 1)? n[0] : n[0]*n[1]);
+  std::vector<Dist>& dist = _dist[lvl];
+  std::vector<long> f(n[dim]);
+  std::vector<long> s(n[dim]);
+  std::vector<long> t(n[dim]);
+  std::vector<long> d(n[dim]);
+  for (unsigned long line = first; line < last; ++line){
+    unsigned long start;
+    switch (dim){
+      case 0: start = line * n[0]; break;
+      case 1: start = (line / n[0]) * n[0]*n[1] + line % n[0]; break;
+      default: start = line;
+    }
+    for (unsigned long i = 0; i < n[dim]; ++i){
+      f[i] = dist[start + i*stride];
+    }
+    transformLine(f, s, t, d);
+    for (unsigned long i = 0; i < n[dim]; ++i){
+      dist[start + i*stride] = (d[i] < long(s_inf))? Dist(d[i]) : s_inf;
+    }
+  }
+}
@@ -0,0 +1,125 @@
+#include "corepyramid.h"
+#include "space.h"
+#include "voxel.h"
+#include "misc.h"
+#include <cmath>
+#include <algorithm> // min, max
+
+/////////////////
+// CONSTRUCTOR //
+/////////////////
+
+CorePyramid::CorePyramid(Space& cell, const char bit_pos_core){
+  const int max_depth = cell.getMaxDepth();
+  for (int lvl = 0; lvl <= max_depth; ++lvl){
+    _n_vxl.push_back(cell.getGridstepsOnLvl(lvl));
+    const std::array<unsigned long,3>& n = _n_vxl.back();
+    _bits.push_back(std::vector<Word>((n[0]*n[1]*n[2] + s_word_bits - 1) / s_word_bits, 0));
+  }
+  const std::array<unsigned long,3>& n_top_vxl = _n_vxl[max_depth];
+  std::array<unsigned,3> top_index;
+  for (top_index[2] = 0; top_index[2] < n_top_vxl[2]; ++top_index[2]){
+    for (top_index[1] = 0; top_index[1] < n_top_vxl[1]; ++top_index[1]){
+      for (top_index[0] = 0; top_index[0] < n_top_vxl[0]; ++top_index[0]){
+        setFromVoxel(cell, cell.getTopVxl(top_index), top_index, max_depth, bit_pos_core);
+      }
+    }
+  }
+  for (int lvl = 1; lvl <= max_depth; ++lvl){
+    poolLevel(lvl);
+  }
+}
+
+// pure voxels containing core set all bottom level bits they cover at once
+void CorePyramid::setFromVoxel(Space& cell, Voxel& vxl, const std::array<unsigned,3>& index, const int lvl, const char bit_pos_core){
+  if (!readBit(vxl.getType(), bit_pos_core)){return;}
+  if (vxl.hasSubvoxel()){
+    for (char j = 0; j < 8; ++j){
+      const std::array<unsigned,3> sub_index = {index[0]*2 + (j&1), index[1]*2 + ((j>>1)&1), index[2]*2 + ((j>>2)&1)};
+      setFromVoxel(cell, vxl.getSubvoxel(cell, index, lvl, j), sub_index, lvl-1, bit_pos_core);
+    }
+    return;
+  }
+  const unsigned edge = 1u << lvl;
+  std::array<unsigned,3> start;
+  for (char i = 0; i < 3; ++i){
+    start[i] = index[i] * edge;
+  }
+  std::array<unsigned,3> row = start;
+  for (row[2] = start[2]; row[2] < start[2] + edge; ++row[2]){
+    for (row[1] = start[1]; row[1] < start[1] + edge; ++row[1]){
+      const unsigned long first = offset(row, 0);
+      setBits(first, first + edge);
+    }
+  }
+}
+
+// sets the bits [first,last) of the bottom level
+void CorePyramid::setBits(const unsigned long first, const unsigned long last){
+  std::vector<Word>& bits = _bits[0];
+  for (unsigned long w = first / s_word_bits; w * s_word_bits < last; ++w){
+    const unsigned long lo = std::max(first, w * s_word_bits) - w * s_word_bits;
+    const unsigned long hi = std::min(last, (w+1) * s_word_bits) - w * s_word_bits;
+    const Word upper = (hi == s_word_bits)? ~Word(0) : ((Word(1) << hi) - 1);
+    bits[w] |= upper & ~((Word(1) << lo) - 1);
+  }
+}
+
+// a voxel contains core, if any of its subvoxels does
+void CorePyramid::poolLevel(const int lvl){
+  const std::array<unsigned long,3>& n = _n_vxl[lvl];
+  std::array<unsigned,3> index;
+  for (index[2] = 0; index[2] < n[2]; ++index[2]){
+    for (index[1] = 0; index[1] < n[1]; ++index[1]){
+      for (index[0] = 0; index[0] < n[0]; ++index[0]){
+        bool core = false;
+        for (char j = 0; j < 8 && !core; ++j){
+          core = hasCore({index[0]*2 + (j&1), index[1]*2 + ((j>>1)&1), index[2]*2 + ((j>>2)&1)}, lvl-1);
+        }
+        if (core){
+          const unsigned long i = offset(index, lvl);
+          _bits[lvl][i / s_word_bits] |= Word(1) << (i % s_word_bits);
+        }
+      }
+    }
+  }
+}
+
+////////////
+// SEARCH //
+////////////
+
+// lower bound for the squared distance from a voxel to the closest voxel on the same level that contains core,
+// in units of the voxel side length. only core within max_dist is considered, otherwise s_inf is returned.
+// the coarse voxels that are about as large as the search range are checked in a box that covers the range.
+// the distance to every coarse voxel with core is measured to the closest of its subvoxels on the voxel's level
+unsigned long CorePyramid::lowerBound(const std::array<unsigned,3>& index, const int lvl, const unsigned long max_dist) const {
+  const long range = std::sqrt(max_dist);
+  int coarse_lvl = lvl;
+  while (coarse_lvl+1 < int(_bits.size()) && (1l << (coarse_lvl-lvl)) < range){coarse_lvl++;}
+  const int shift = coarse_lvl - lvl;
+  const long edge = 1l << shift;
+  std::array<unsigned,3> box_min;
+  std::array<unsigned,3> box_max;
+  for (char i = 0; i < 3; ++i){
+    box_min[i] = std::max(0l, long(index[i]) - range) >> shift;
+    box_max[i] = std::min(long(_n_vxl[lvl][i]) - 1, long(index[i]) + range) >> shift;
+  }
+  unsigned long bound = s_inf;
+  std::array<unsigned,3> coarse;
+  for (coarse[2] = box_min[2]; coarse[2] <= box_max[2]; ++coarse[2]){
+    for (coarse[1] = box_min[1]; coarse[1] <= box_max[1]; ++coarse[1]){
+      for (coarse[0] = box_min[0]; coarse[0] <= box_max[0]; ++coarse[0]){
+        if (!hasCore(coarse, coarse_lvl)){continue;}
+        unsigned long dist = 0;
+        for (char i = 0; i < 3; ++i){
+          const long first = long(coarse[i]) * edge;
+          const long gap = std::max({0l, first - long(index[i]), long(index[i]) - (first + edge - 1)});
+          dist += gap*gap;
+        }
+        bound = std::min(bound, dist);
+      }
+    }
+  }
+  return (bound > max_dist)? s_inf : bound;
+}
@@ -0,0 +1,53 @@
+#include "flatatomtree.h"
+#include "atomtree.h"
+#include "atom.h"
+#include <algorithm> // min, max
+
+/////////////////
+// CONSTRUCTOR //
+/////////////////
+
+// the atoms are sorted by building an AtomTree, so that both trees have exactly the same structure
+FlatAtomTree::FlatAtomTree(const std::vector<Atom>& list_of_atoms){
+  {
+    AtomTree tree(list_of_atoms);
+    _atom_list = tree.getAtomList();
+  }
+  const size_t n = _atom_list.size();
+  for (char dim = 0; dim < 3; ++dim){
+    _pos[dim].resize(n);
+    _box_min[dim].resize(n);
+    _box_max[dim].resize(n);
+  }
+  _rad.resize(n);
+  _max_rad.resize(n);
+  for (size_t i = 0; i < n; ++i){
+    for (char dim = 0; dim < 3; ++dim){
+      _pos[dim][i] = _atom_list[i].getCoordinate(dim);
+    }
+    _rad[i] = _atom_list[i].getRad();
+  }
+  fitBounds(0, n);
+}
+
+// sets the bounds of the subtree of the range [first,end) after the bounds of its children
+void FlatAtomTree::fitBounds(const int first, const int end){
+  if (first >= end){return;}
+  const int node = rootOf(first, end);
+  fitBounds(first, node);
+  fitBounds(node+1, end);
+  for (char dim = 0; dim < 3; ++dim){
+    _box_min[dim][node] = _pos[dim][node];
+    _box_max[dim][node] = _pos[dim][node];
+  }
+  _max_rad[node] = _rad[node];
+  for (const std::array<int,2>& child : {std::array<int,2>{first, node}, std::array<int,2>{node+1, end}}){
+    if (child[0] >= child[1]){continue;}
+    const int child_node = rootOf(child[0], child[1]);
+    for (char dim = 0; dim < 3; ++dim){
+      _box_min[dim][node] = std::min(_box_min[dim][node], _box_min[dim][child_node]);
+      _box_max[dim][node] = std::max(_box_max[dim][node], _box_max[dim][child_node]);
+    }
+    _max_rad[node] = std::max(_max_rad[node], _max_rad[child_node]);
+  }
+}
@@ -13,7 +13,7 @@
 // CALCRESULTBUNDLE //
 //////////////////////
 
-std::array<double,3> CalcReportBundle::getCavCentre(const unsigned char i){
+std::array<double,3> CalcReportBundle::getCavCentre(const size_t i){
   std::array<double,3> cav_ctr;
   for (char j = 0; j < 3; ++j){
     cav_ctr[j] = (cavities[i].min_bound[j] + cavities[i].max_bound[j])/2;
@@ -29,6 +29,14 @@ double CalcReportBundle::getTime(){
   return total_seconds;
 }
 
+//////////////////
+// CONSTRUCTORS //
+//////////////////
+
+Model::Model() : _monitor(Ctrl::getInstance()) {}
+
+Model::Model(CalcMonitor& monitor) : _monitor(&monitor) {}
+
 ////////////////////////////////////
 // CONTROLLER-MODEL COMMUNICATION //
 ////////////////////////////////////
@@ -102,7 +110,7 @@ CalcReportBundle Model::generateData(){
   _time_stamp = timeNow();
   CalcReportBundle data;
   data = generateVolumeData();
-  if(Ctrl::getInstance()->getAbortFlag()){return data;}
+  if(isAborted()){return data;}
   // surface calculation requires running the volume calculation first, but shouldn't be inside the volume calc function
   if (optionCalcSurfaceAreas() && data.success){
     data = generateSurfaceData();
@@ -117,8 +125,8 @@ CalcReportBundle Model::generateVolumeData(){
   { // assign each voxel in grid a type
     auto start = std::chrono::steady_clock::now();
     bool cavities_exceeded = false;
-    _cell.assignTypeInGrid(_atoms, getProbeRad1(), getProbeRad2(), optionProbeMode(), cavities_exceeded);
-    if(Ctrl::getInstance()->getAbortFlag()){
+    _cell.assignTypeInGrid(_atoms, getProbeRad1(), getProbeRad2(), optionProbeMode(), optionCellList()? AtomIndex::CellList : AtomIndex::Tree, optionDistanceTransform(), cavities_exceeded);
+    if(isAborted()){
       _data.success = false;
       return _data;
     }
@@ -140,6 +148,18 @@ CalcReportBundle Model::generateVolumeData(){
     auto end = std::chrono::steady_clock::now();
     _data.addTime(std::chrono::duration<double>(end-start).count());
   }
+  if (optionCavityTree()){ // merge tree of the cavities over the probe radius
+    auto start = std::chrono::steady_clock::now();
+    bool tree_exceeded = false;
+    _cell.buildCavityTree(_atoms, getProbeRad1(), optionCellList()? AtomIndex::CellList : AtomIndex::Tree, _data.cavities, tree_exceeded);
+    if(isAborted()){
+      _data.success = false;
+      return _data;
+    }
+    if(tree_exceeded){Ctrl::getInstance()->displayErrorMessage(202);}
+    auto end = std::chrono::steady_clock::now();
+    _data.addTime(std::chrono::duration<double>(end-start).count());
+  }
   return _data;
 }
 
@@ -174,8 +194,8 @@ void Model::prepareVolumeCalc(){
 CalcReportBundle Model::generateSurfaceData(){
   // requires volume calculation!
   auto start = std::chrono::steady_clock::now();
-  Ctrl::getInstance()->updateStatus("Calculating surface areas...");
-  Ctrl::getInstance()->updateProgressBar(0);
+  _monitor->updateStatus("Calculating surface areas...");
+  _monitor->updateProgressBar(0);
 
   std::vector<std::vector<char>> solid_types =
   { {0b00000011},
@@ -183,49 +203,22 @@ CalcReportBundle Model::generateSurfaceData(){
     {0b00001001, 0b00010001},
     {0b00001001} };
 
-  const int total_surfaces = solid_types.size() + 2*_data.cavities.size();
-  auto percentageDone = [](double num, double denom){return int(100*num/denom);};
-
-  // full structure surfaces
-  {
-    std::vector<double> surfaces; // temporary
-    for(size_t i = 0; i < solid_types.size(); ++i){
-      // special case for this set of types, to avoid recalculation
-      if (i == 2 && !optionProbeMode()){
-        surfaces.push_back(surfaces[1]);
-      }
-      else {
-        surfaces.push_back(_cell.calcSurfArea(solid_types[i]));
-      }
-      Ctrl::getInstance()->updateProgressBar(percentageDone(i+1,total_surfaces));
-      // check abort flag
-      if(Ctrl::getInstance()->getAbortFlag()){
-        _data.success = false;
-        return _data;
-      }
-    }
-    // from temporary container to _data
-    _data.surf_vdw = surfaces[0];
-    _data.surf_molecular = surfaces[1];
-    _data.surf_probe_excluded = surfaces[2];
-    _data.surf_probe_accessible = surfaces[3];
+  // full structure surfaces and cavity surfaces
+  std::vector<double> surfaces;
+  _cell.calcSurfAreas(solid_types, solid_types[2], solid_types[3], surfaces, _data.cavities);
+  // check abort flag
+  if(isAborted()){
+    _data.success = false;
+    return _data;
   }
-
-  // cavity surfaces
-  for (size_t i = 0; i < _data.cavities.size(); ++i){
-    Cavity& cav = _data.cavities[i];
-
-    cav.surf_shell = _cell.calcSurfArea(solid_types[2], cav.id, cav.min_index, cav.max_index);
-    Ctrl::getInstance()->updateProgressBar(percentageDone(solid_types.size() + i*2 + 1,total_surfaces));
-
-    cav.surf_core = _cell.calcSurfArea(solid_types[3], cav.id, cav.min_index, cav.max_index);
-    Ctrl::getInstance()->updateProgressBar(percentageDone(solid_types.size() + i*2 + 2,total_surfaces));
-
-    if(Ctrl::getInstance()->getAbortFlag()){
-      _data.success = false;
-      return _data;
-    }
+  // special case for this set of types
+  if (!optionProbeMode()){
+    surfaces[2] = surfaces[1];
   }
+  _data.surf_vdw = surfaces[0];
+  _data.surf_molecular = surfaces[1];
+  _data.surf_probe_excluded = surfaces[2];
+  _data.surf_probe_accessible = surfaces[3];
 
   auto end = std::chrono::steady_clock::now();
   _data.addTime(std::chrono::duration<double>(end-start).count());
@@ -310,7 +303,7 @@ void Model::defineCell(){
   if(optionAnalyzeUnitCell()){
     unit_cell_limits = {_cart_matrix[0][0], _cart_matrix[1][1], _cart_matrix[2][2]};
   }
-  _cell = Space(_atoms, _data.grid_step, _data.max_depth, optionProbeMode()? getProbeRad2() : getProbeRad1(), optionAnalyzeUnitCell(), unit_cell_limits);
+  _cell = Space(_atoms, _data.grid_step, _data.max_depth, optionProbeMode()? getProbeRad2() : getProbeRad1(), optionAnalyzeUnitCell(), unit_cell_limits, _data.options.n_threads, _data.options.lazy_inheritance, _data.options.sparse_octree, *_monitor);
   return;
 }
 
@@ -13,7 +13,7 @@
 // RESULT REPORT //
 ///////////////////
 
-std::string makeExportFileName(const std::string, const CalcReportBundle&, const char, const unsigned char=0);
+std::string makeExportFileName(const std::string, const CalcReportBundle&, const char, const size_t=0);
 void Model::createReport(){
   createReport(makeExportFileName(_output_folder, _data, 'r'));
 }
@@ -166,11 +166,6 @@ void Model::createReport(std::string path){
     output_report << "\t// Cavities and pockets data //\n";
     output_report << "\t///////////////////////////////\n\n";
 
-    if(_data.cavities.size() >= 255){
-      output_report << "!!! WARNING !!!\n";
-      output_report << "Maximum number of cavities reached. Some cavities might be missing.\n";
-      output_report << "To solve this issue, change probe radii (e.g. smaller large probe and/or larger small probe).\n\n";
-    }
     output_report << "Note 1:\tPockets and isolated cavities are not differentiated yet.\n";
     output_report << "\tThis feature might be added in future versions if requested by the community.\n";
     output_report << "Note 2:\tSeparate cavities are defined by space accessible to the core of the small probe.\n";
@@ -203,6 +198,28 @@ void Model::createReport(std::string path){
       }
       output_report << cav_center[0] << "\t" << cav_center[1] << "\t" << cav_center[2] << "\n";
     }
+
+    if(_data.options.cavity_tree){
+      output_report << "\nCavity merge tree:\n";
+      output_report << "Note 1:\tThe largest probe is the largest probe radius that fits into the cavity.\n";
+      output_report << "Note 2:\tAs the probe shrinks, cavities merge. Each cavity merges into the cavity with the larger\n";
+      output_report << "\tlargest probe, at the largest probe radius that can pass from one to the other.\n";
+      output_report << "\tThe bottleneck radius between any two cavities is the smallest one on the path between them.\n\n";
+      output_report << "Cavity\tLargest\t\tMerges\t\tBottleneck\tLargest probe center coordinates (A)\n";
+      output_report << "ID\tprobe (A)\tinto ID\t\tprobe (A)\tx\ty\tz\n";
+      const std::map<CavityID,size_t> cavity_numbers = listCavityNumbers(_data.cavities);
+      for(unsigned int i = 0; i < _data.cavities.size(); i++){
+        const Cavity& cav = _data.cavities[i];
+        output_report << i+1 << "\t" << cav.max_probe << "\t\t";
+        if(cav.merge_id != 0){
+          output_report << cavity_numbers.at(cav.merge_id) << "\t\t" << cav.merge_probe << "\t\t";
+        }
+        else{
+          output_report << "-\t\t-\t\t";
+        }
+        output_report << cav.max_probe_pos[0] << "\t" << cav.max_probe_pos[1] << "\t" << cav.max_probe_pos[2] << "\n";
+      }
+    }
   }
   output_report << "\n\n\t/////////////////////////////\n";
   output_report << "\t// Surface map information //\n";
@@ -279,7 +296,7 @@ void Model::writeTotalSurfaceMap(){
 
 void Model::writeTotalSurfaceMap(const std::string file_path){
   // save commonly used variable
-  std::array<unsigned long int,3> n_elements = _cell.getGrid(0).getNumElements();
+  std::array<unsigned long int,3> n_elements = _cell.getGridstepsOnLvl(0);
   double vxl_length = _cell.getVxlSize();
   std::array<double,3> cell_min = _cell.getMin();
   std::array<double,3> origin;
@@ -330,7 +347,7 @@ void Model::writeCavitiesMaps(const std::string file_path){
 
   // loop over each cavity id
   for(size_t id = 0; id < _data.cavities.size(); id++){
-    std::array<unsigned long int,3> n_elements = _cell.getGrid(0).getNumElements();
+    std::array<unsigned long int,3> n_elements = _cell.getGridstepsOnLvl(0);
     start_index = _data.cavities[id].min_index;
     end_index = _data.cavities[id].max_index;
     // increase size of surface map grid by 1 voxel in each direction to avoid having surfaces on the border of the map
@@ -368,10 +385,8 @@ void Model::writeSurfaceMap(const std::string file_path,
                             std::array<unsigned int,3> start_index,
                             std::array<unsigned int,3> end_index,
                             const bool partial_map,
-                            const unsigned char id){
+                            const CavityID id){
   bool issue_encountered = false;
-  // assemble data
-  Container3D<Voxel>* surface_map = &_cell.getGrid(0);
 
   // create map for assigning numbers to types
   const std::map<char,int> typeToNum =
@@ -423,9 +438,12 @@ void Model::writeSurfaceMap(const std::string file_path,
   for(unsigned long int x = start_index[0]; x < end_index[0]; x++){
     for(unsigned long int y = start_index[1]; y < end_index[1]; y++){
       for(unsigned long int z = start_index[2]; z < end_index[2]; z++){
-        if (typeToNum.count(surface_map->getElement(x,y,z).getType()) != 0){
-          if (partial_map? surface_map->getElement(x,y,z).getID() == _data.cavities[id].id : true){
-            output_file << typeToNum.find(surface_map->getElement(x,y,z).getType())->second;
+        // with lazy inheritance, the type of a subvoxel is looked up from its pure parent
+        const std::array<unsigned int,3> index = {(unsigned)x,(unsigned)y,(unsigned)z};
+        const Voxel& vxl = _cell.getResolvedVxl(index, 0);
+        if (typeToNum.count(vxl.getType()) != 0){
+          if (partial_map? _cell.getCavityID(index, 0) == _data.cavities[id].id : true){
+            output_file << typeToNum.find(vxl.getType())->second;
           }
           else {
             output_file << 0;
@@ -474,7 +492,7 @@ static const std::map<char,std::string> s_file_extension{
 
 bool fileExists(const std::string&);
 std::string rstripZeros(const std::string str);
-std::string makeExportFileName(const std::string dir, const CalcReportBundle& data, const char filetype, const unsigned char n_cav){
+std::string makeExportFileName(const std::string dir, const CalcReportBundle& data, const char filetype, const size_t n_cav){
   assert(s_file_descriptor.count(filetype));
   std::string filename = "";
   filename += fileName(data.atom_file_path);
@@ -4,21 +4,25 @@
 #include "atomtree.h"
 #include "misc.h"
 #include "exception.h"
-#include "controller.h"
+#include "threadpool.h"
+#include "unionfind.h"
+#include "cavitytree.h"
+#include "vector.h"
 #include <cmath>
 #include <cassert>
 #include <stdexcept>
 #include <algorithm> // find
 #include <numeric> // accumulate
+#include <limits>
 
 /////////////////
 // CONSTRUCTOR //
 /////////////////
 
-Space::Space(std::vector<Atom> &atoms, const double bot_lvl_vxl_dist, const int depth, const double r_probe, const bool unit_cell_option, const std::array<double,3> unit_cell_axes)
-  :_grid_size(bot_lvl_vxl_dist), _max_depth(depth), _unit_cell_limits(unit_cell_axes), _unit_cell(unit_cell_option){
+Space::Space(std::vector<Atom> &atoms, const double bot_lvl_vxl_dist, const int depth, const double r_probe, const bool unit_cell_option, const std::array<double,3> unit_cell_axes, const unsigned n_threads, const bool lazy_inheritance, const bool sparse_octree, CalcMonitor& monitor)
+  :_grid_size(bot_lvl_vxl_dist), _max_depth(depth), _unit_cell_limits(unit_cell_axes), _unit_cell(unit_cell_option), _n_threads(ThreadPool::evalNumThreads(n_threads)), _lazy_inheritance(lazy_inheritance || sparse_octree), _monitor(&monitor){
   setBoundaries(atoms,r_probe+2*bot_lvl_vxl_dist);
-  initGrid();
+  initGrid(sparse_octree);
 }
 
 ///////////////////////////////
@@ -84,9 +88,12 @@ void Space::setBoundaries(const std::vector<Atom> &atoms, const double add_space
 }
 
 // based on the grid step and the octree _max_depth, this function produces a
-// 3D grid (in form of a 1D vector) that contains all top level voxels.
-void Space::initGrid(){
+// 3D grid (in form of a 1D vector) that contains all top level voxels. for a sparse octree, the lower
+// levels are left empty and subvoxels are only allocated once their parent is split
+void Space::initGrid(const bool sparse_octree){
   _grid.clear();
+  _subvoxels.reset();
+  _cavity_ids.reset();
   // determine how many top lvl voxels in each direction are needed
   std::array<unsigned long,3> n_top_lvl_vxl;
   for (int dim = 0; dim < 3; dim++){
@@ -94,10 +101,18 @@ void Space::initGrid(){
   }
   // initialise 3d tensors for each octree level
   for (int lvl = 0; lvl <= _max_depth; ++lvl){
-    _grid.push_back(Container3D<Voxel>( n_top_lvl_vxl[0]*pow(2,_max_depth-lvl),
-                                        n_top_lvl_vxl[1]*pow(2,_max_depth-lvl),
-                                        n_top_lvl_vxl[2]*pow(2,_max_depth-lvl)));
+    if (sparse_octree && lvl < _max_depth){
+      _grid.push_back(VoxelGrid());
+      continue;
+    }
+    _grid.push_back(VoxelGrid( n_top_lvl_vxl[0]*pow(2,_max_depth-lvl),
+                               n_top_lvl_vxl[1]*pow(2,_max_depth-lvl),
+                               n_top_lvl_vxl[2]*pow(2,_max_depth-lvl)));
+  }
+  if (sparse_octree){
+    _subvoxels = std::make_unique<SubvoxelPool>(n_top_lvl_vxl);
   }
+  _cavity_ids = std::make_unique<CavityIDTable>(n_top_lvl_vxl, _max_depth);
 }
 
 /////////////////////
@@ -105,113 +120,347 @@ void Space::initGrid(){
 /////////////////////
 
 // sets all voxel's types, determined by the input atoms
-void Space::assignTypeInGrid(std::vector<Atom>& atomlist, const double r_probe1, const double r_probe2, bool probe_mode, bool& cavities_exceeded){
-  // save variable that all voxels need access to for their type determination as static members of Voxel class
-  Voxel::prepareTypeAssignment(this, atomlist);
+void Space::assignTypeInGrid(std::vector<Atom>& atomlist, const double r_probe1, const double r_probe2, bool probe_mode, const AtomIndex::Engine engine, const bool distance_transform, bool& cavities_exceeded){
+  // everything the voxels need access to for their type determination is stored in a context that belongs
+  // to this calculation only. therefore, several calculations may run at the same time
+  CalcContext ctx(*this, atomlist, engine, probe_mode? std::max(r_probe1, r_probe2) : r_probe1, *_monitor);
   if (probe_mode){
     // first run algorithm with the larger probe to exclude most voxels - "masking mode"
-    Voxel::storeProbe(r_probe2, true);
-    Ctrl::getInstance()->updateStatus("Blocking off cavities with large probe...");
-    assignAtomVsCore();
-    assignShellVsVoid();
+    ctx.storeProbe(r_probe2, true);
+    ctx.monitor.updateStatus("Blocking off cavities with large probe...");
+    assignAtomVsCore(ctx);
+    prepareShellSearch(ctx, distance_transform);
+    assignShellVsVoid(ctx);
   }
 
-  Ctrl::getInstance()->updateStatus(std::string("Probing space") + (probe_mode? " with small probe..." : "..."));
-  Voxel::storeProbe(r_probe1, false);
-  assignAtomVsCore();
+  ctx.monitor.updateStatus(std::string("Probing space") + (probe_mode? " with small probe..." : "..."));
+  ctx.storeProbe(r_probe1, false);
+  assignAtomVsCore(ctx);
 
-  Ctrl::getInstance()->updateStatus("Identifying cavities...");
-  try{identifyCavities();}
+  ctx.monitor.updateStatus("Identifying cavities...");
+  try{identifyCavities(ctx);}
   catch (const std::overflow_error& e){cavities_exceeded = true;}
 
-  Ctrl::getInstance()->updateStatus("Searching inaccessible areas...");
-  assignShellVsVoid();
+  ctx.monitor.updateStatus("Searching inaccessible areas...");
+  prepareShellSearch(ctx, distance_transform);
+  assignShellVsVoid(ctx);
 }
 
-void Space::assignAtomVsCore(){
-  if (Ctrl::getInstance()->getAbortFlag()){return;}
-  // calculate position of first voxel
-  const std::array<double,3> vxl_origin = getOrigin();
-  // calculate side length of top level voxel
-  const double vxl_dist = _grid_size * pow(2,_max_depth);
-  std::array<double,3> vxl_pos;
-  std::array<unsigned,3> top_lvl_index;
-  for(top_lvl_index[0] = 0; top_lvl_index[0] < getGridsteps()[0]; top_lvl_index[0]++){
-    Ctrl::getInstance()->updateCalculationStatus();
-    vxl_pos[0] = vxl_origin[0] + vxl_dist * (0.5 + top_lvl_index[0]);
-    for(top_lvl_index[1] = 0; top_lvl_index[1] < getGridsteps()[1]; top_lvl_index[1]++){
-      vxl_pos[1] = vxl_origin[1] + vxl_dist * (0.5 + top_lvl_index[1]);
-      for(top_lvl_index[2] = 0; top_lvl_index[2] < getGridsteps()[2]; top_lvl_index[2]++){
-        vxl_pos[2] = vxl_origin[2] + vxl_dist * (0.5 + top_lvl_index[2]);
-        // voxel position is deliberately not stored in voxel object to reduce memory cost
-        if (Ctrl::getInstance()->getAbortFlag()){return;}
-        getTopVxl(top_lvl_index).evalRelationToAtoms(top_lvl_index, vxl_pos, _max_depth);
+void Space::assignAtomVsCore(const CalcContext& ctx){
+  if (ctx.isAborted()){return;}
+  // every top level voxel only modifies itself and its subvoxels, therefore voxels can be evaluated in any order.
+  // voxels surrounded by many atoms are likely to be split many times, and are evaluated first
+  forEachTopVxl(ctx,
+    [&](const std::array<unsigned,3>& top_lvl_index){
+      return Voxel::countNearbyAtoms(ctx, calcTopVxlPos(top_lvl_index), _max_depth);
+    },
+    [&](const std::array<unsigned,3>& top_lvl_index){
+      // voxel position is deliberately not stored in voxel object to reduce memory cost
+      getTopVxl(top_lvl_index).evalRelationToAtoms(ctx, top_lvl_index, calcTopVxlPos(top_lvl_index), _max_depth);
+    });
+}
+
+// every connected region of core leaves is one cavity. two leaves are connected if they touch, including
+// along edges and at corners. the leaves are numbered in the order of a scan through the octree and the
+// regions are found by merging the sets of touching leaves. all steps are independent for each leaf and
+// run in parallel. the cavity IDs are then assigned in the order of the scan, which is the order in which
+// a flood fill through the grid would discover the cavities
+void Space::identifyCavities(const CalcContext& ctx){
+  if (ctx.isAborted()){return;}
+  const std::array<unsigned long,3> n_top_lvl_vxl = getGridsteps();
+  std::unique_ptr<ThreadPool> pool;
+  if (_n_threads > 1){pool = std::make_unique<ThreadPool>(_n_threads);}
+
+  // collect the core leaves, one slab of top level voxels per task
+  std::vector<std::vector<VoxelLoc>> slab_leaves(n_top_lvl_vxl[0]);
+  forEachChunk(ctx, pool.get(), n_top_lvl_vxl[0], 1, [&](unsigned long x, unsigned long){
+    std::array<unsigned,3> index = {(unsigned)x,0,0};
+    for (index[1] = 0; index[1] < n_top_lvl_vxl[1]; index[1]++){
+      for (index[2] = 0; index[2] < n_top_lvl_vxl[2]; index[2]++){
+        if (ctx.isAborted()){return;}
+        collectCoreLeaves(slab_leaves[x], index, _max_depth);
       }
     }
-    Ctrl::getInstance()->updateProgressBar(int(100*(double(top_lvl_index[0])+1)/double(getGridsteps()[0])));
+  });
+  if (ctx.isAborted()){return;}
+  std::vector<VoxelLoc> leaves;
+  for (std::vector<VoxelLoc>& slab : slab_leaves){
+    leaves.insert(leaves.end(), slab.begin(), slab.end());
+    std::vector<VoxelLoc>().swap(slab);
   }
-}
-
-void Space::identifyCavities(){
-  if (Ctrl::getInstance()->getAbortFlag()){return;}
-  std::array<unsigned int,3> vxl_index;
-  unsigned char id = 1;
-  for(vxl_index[0] = 0; vxl_index[0] < getGridsteps()[0]; vxl_index[0]++){
-    for(vxl_index[1] = 0; vxl_index[1] < getGridsteps()[1]; vxl_index[1]++){
-      for(vxl_index[2] = 0; vxl_index[2] < getGridsteps()[2]; vxl_index[2]++){
-        if (Ctrl::getInstance()->getAbortFlag()){return;}
-        try{
-          descendToCore(id,vxl_index,getMaxDepth()); // id gets iterated inside this function
-        }
-        catch (const std::overflow_error& e){
-          throw;
+  // the temporary IDs of the leaves are their position in the list + 1
+  if (leaves.size() >= std::numeric_limits<CavityID>::max()){
+    throw std::overflow_error("Too many core leaves for 32-bit cavity IDs!");
+  }
+  const unsigned long chunk_size = std::max(1ul, (unsigned long)(leaves.size()/(64*_n_threads)));
+  forEachChunk(ctx, pool.get(), leaves.size(), chunk_size, [&](unsigned long first, unsigned long last){
+    for (unsigned long i = first; i < last; ++i){
+      setCavityID(leaves[i].index, leaves[i].lvl, i+1);
+    }
+  });
+
+  // merge the sets of all touching leaves
+  std::vector<std::vector<std::array<int,3>>> neighbour_indices = SearchIndex().computeIndices(3);
+  neighbour_indices.erase(neighbour_indices.begin());
+  UnionFind cavities(leaves.size());
+  forEachChunk(ctx, pool.get(), leaves.size(), chunk_size, [&](unsigned long first, unsigned long last){
+    std::vector<VoxelLoc> nb_leaves;
+    for (unsigned long i = first; i < last; ++i){
+      if (ctx.isAborted()){return;}
+      const VoxelLoc& leaf = leaves[i];
+      for (const auto& shell : neighbour_indices){
+        for (const auto& rel_index : shell){
+          std::array<unsigned,3> nb_index = add(leaf.index, rel_index);
+          if (!isInBounds(nb_index,leaf.lvl)){continue;} // skip if index is invalid
+          int nb_lvl = leaf.lvl;
+          Voxel& nb_vxl = resolveLeaf(nb_index,nb_lvl);
+          if (!nb_vxl.isCore()){continue;} // skip if neighbour is not core
+          if (!nb_vxl.hasSubvoxel()){
+            cavities.unite(i, getCavityID(nb_index, nb_lvl)-1);
+            continue;
+          }
+          // the neighbour is smaller than the leaf. only the subvoxels facing the leaf touch it
+          nb_leaves.clear();
+          nb_vxl.listBorderingCoreLeaves(*this, nb_leaves, nb_index, nb_lvl, rel_index);
+          for (const VoxelLoc& nb_leaf : nb_leaves){
+            cavities.unite(i, getCavityID(nb_leaf.index, nb_leaf.lvl)-1);
+          }
         }
       }
     }
-    Ctrl::getInstance()->updateProgressBar(int(100*(double(vxl_index[0])+1)/double(getGridsteps()[0])));
+  });
+  if (ctx.isAborted()){return;}
+
+  // the root of each set is its first leaf in scan order, so numbering the roots in order gives the cavity IDs
+  std::vector<CavityID> final_ids(leaves.size());
+  CavityID n_cavities = 0;
+  for (UnionFind::Element i = 0; i < leaves.size(); ++i){
+    const UnionFind::Element root = cavities.find(i);
+    final_ids[i] = (root == i)? ++n_cavities : final_ids[root];
   }
+  forEachChunk(ctx, pool.get(), leaves.size(), chunk_size, [&](unsigned long first, unsigned long last){
+    for (unsigned long i = first; i < last; ++i){
+      setCavityID(leaves[i].index, leaves[i].lvl, final_ids[i]);
+    }
+  });
+  ctx.monitor.updateProgressBar(100);
 }
 
-void Space::descendToCore(unsigned char& id, const std::array<unsigned,3> index, int lvl){
+// appends all core voxels without subvoxels within the voxel, in the order x, y, z of the subvoxels
+void Space::collectCoreLeaves(std::vector<VoxelLoc>& leaves, const std::array<unsigned,3>& index, const int lvl){
   Voxel& vxl = getVxlFromGrid(index,lvl);
   if (!vxl.isCore()){return;}
   if (!vxl.hasSubvoxel()){
-    if(vxl.floodFill(id, index, lvl)){
-      if (id == 0b11111111){
-        throw std::overflow_error("Too many isolated cavities detected!");
+    leaves.push_back(VoxelLoc(index, lvl));
+    return;
+  }
+  std::array<unsigned,3> subindex;
+  for (char i = 0; i < 2; ++i){
+    subindex[0] = index[0]*2 + i;
+    for (char j = 0; j < 2; ++j){
+      subindex[1] = index[1]*2 + j;
+      for (char k = 0; k < 2; ++k){
+        subindex[2] = index[2]*2 + k;
+        collectCoreLeaves(leaves, subindex, lvl-1);
       }
-      id++;
-    }
-  }
-  else {
-    std::array<unsigned,3> subindex;
-    for (char i = 0; i < 2; ++i){
-      subindex[0] = index[0]*2 + i;
-      for (char j = 0; j < 2; ++j){
-        subindex[1] = index[1]*2 + j;
-        for (char k = 0; k < 2; ++k){
-          subindex[2] = index[2]*2 + k;
-          if (Ctrl::getInstance()->getAbortFlag()){return;}
-          try {descendToCore(id, subindex, lvl-1);}
-          catch (const std::overflow_error& e){throw;}
+    }
+  }
+}
+
+// fills in the merge tree of the cavities over the probe radius. requires the cavity IDs of the probe, which
+// is the small probe in the two probe mode. the clearance and cavity of the bottom level voxels are computed
+// one top level voxel per task, the merging itself is sequential. if the grid has too many voxels for the tree,
+// the cavities are left without merges
+void Space::buildCavityTree(std::vector<Atom>& atomlist, const double r_probe, const AtomIndex::Engine engine, std::vector<Cavity>& cavities, bool& tree_exceeded){
+  if (cavities.empty()){return;}
+  CalcContext ctx(*this, atomlist, engine, r_probe, *_monitor);
+  ctx.storeProbe(r_probe, false);
+  CavityTree tree(*this);
+  ctx.monitor.updateStatus("Building cavity merge tree...");
+  forEachTopVxl(ctx,
+    [&](const std::array<unsigned,3>& top_lvl_index){
+      return Voxel::countNearbyAtoms(ctx, calcTopVxlPos(top_lvl_index), _max_depth);
+    },
+    [&](const std::array<unsigned,3>& top_lvl_index){
+      tree.evalTopVxl(ctx, top_lvl_index, calcTopVxlPos(top_lvl_index));
+    });
+  if (ctx.isAborted()){return;}
+  try{tree.build(cavities);}
+  catch (const std::overflow_error& e){tree_exceeded = true;}
+}
+
+void Space::assignShellVsVoid(const CalcContext& ctx){
+  if (ctx.isAborted()){return;}
+  // voxels only read the core bits of their neighbours, which are never changed during this step, so voxels can
+  // be evaluated in any order. a neighbour may still be rewritten by another thread while it is read, which is why
+  // the voxel type is atomic (see Voxel). assigned voxels return immediately, split voxels are the most expensive
+  forEachTopVxl(ctx,
+    [&](const std::array<unsigned,3>& index){
+      Voxel& vxl = getTopVxl(index);
+      return vxl.isAssigned()? 0u : (vxl.hasSubvoxel()? 2u : 1u);
+    },
+    [&](const std::array<unsigned,3>& index){
+      getTopVxl(index).evalRelationToVoxels(ctx, index, _max_depth);
+    });
+}
+
+// the core bits of the current probe don't change during the shell vs void assignment. the structures that
+// speed up the search for core are built from them beforehand
+void Space::prepareShellSearch(CalcContext& ctx, const bool distance_transform){
+  if (ctx.isAborted()){return;}
+  ctx.core_pyramid = CorePyramid(); // release the pyramid of the previous probe first
+  ctx.core_pyramid = CorePyramid(*this, ctx.getCoreBit());
+  if (distance_transform){computeCoreDistances(ctx);}
+}
+
+// distance transform engine for the shell vs void assignment. for every level, the squared distance from each
+// voxel to the closest voxel containing probe core is computed before the neighbour search. no core is closer
+// than that distance, so the search can start at the shell of that distance and gives the same result as the
+// full search. voxels without any core in range do not search at all
+void Space::computeCoreDistances(CalcContext& ctx){
+  if (ctx.isAborted()){return;}
+  const char bit_pos_core = ctx.getCoreBit();
+  std::vector<std::array<unsigned long,3>> n_vxl;
+  for (int lvl = 0; lvl <= _max_depth; ++lvl){
+    n_vxl.push_back(getGridstepsOnLvl(lvl));
+  }
+  ctx.core_distances = CoreDistanceMap(); // release the map of the previous probe first
+  ctx.core_distances = CoreDistanceMap(n_vxl);
+  std::unique_ptr<ThreadPool> pool;
+  if (_n_threads > 1){pool = std::make_unique<ThreadPool>(_n_threads);}
+  for (int lvl = 0; lvl <= _max_depth; ++lvl){
+    // the core bits are read from the closest existing ancestor, like the neighbour search does
+    forEachChunk(ctx, pool.get(), n_vxl[lvl][2], 1, [&](unsigned long z, unsigned long){
+      std::array<unsigned,3> index = {0,0,(unsigned)z};
+      for (index[1] = 0; index[1] < n_vxl[lvl][1]; index[1]++){
+        for (index[0] = 0; index[0] < n_vxl[lvl][0]; index[0]++){
+          ctx.core_distances.setCore(index, lvl, readBit(getResolvedVxl(index, lvl).getType(), bit_pos_core));
         }
       }
+    });
+    for (char dim = 0; dim < 3; ++dim){
+      const unsigned long n_lines = ctx.core_distances.getNumLines(lvl, dim);
+      const unsigned long chunk_size = std::max(1ul, n_lines/(64*_n_threads));
+      forEachChunk(ctx, pool.get(), n_lines, chunk_size, [&](unsigned long first, unsigned long last){
+        ctx.core_distances.transformLines(lvl, dim, first, last);
+      });
     }
   }
 }
 
-void Space::assignShellVsVoid(){
-  if (Ctrl::getInstance()->getAbortFlag()){return;}
-  std::array<unsigned int,3> vxl_index;
-  for(vxl_index[0] = 0; vxl_index[0] < getGridsteps()[0]; vxl_index[0]++){
-    Ctrl::getInstance()->updateCalculationStatus();
-    for(vxl_index[1] = 0; vxl_index[1] < getGridsteps()[1]; vxl_index[1]++){
-      for(vxl_index[2] = 0; vxl_index[2] < getGridsteps()[2]; vxl_index[2]++){
-        if (Ctrl::getInstance()->getAbortFlag()){return;}
-        getTopVxl(vxl_index).evalRelationToVoxels(vxl_index, _max_depth);
+// calls vxl_func for every top level voxel. with a single thread, the voxels are evaluated in order of their
+// index. otherwise, the voxels are sorted by estimated cost and handed to the thread pool in chunks, most
+// expensive first, so that the cheap voxels fill the gaps towards the end. voxels that are split during
+// the evaluation spawn their subvoxels as tasks that idle threads can steal.
+// only the calling thread reports to the monitor, because the GUI must not be accessed by the workers
+void Space::forEachTopVxl(const CalcContext& ctx, const std::function<unsigned(const std::array<unsigned,3>&)>& estimate_cost,
+                          const std::function<void(const std::array<unsigned,3>&)>& vxl_func){
+  const std::array<unsigned long,3> n_top_lvl_vxl = getGridsteps();
+  if (_n_threads <= 1){
+    std::array<unsigned,3> index;
+    for (index[0] = 0; index[0] < n_top_lvl_vxl[0]; index[0]++){
+      ctx.monitor.updateCalculationStatus();
+      for (index[1] = 0; index[1] < n_top_lvl_vxl[1]; index[1]++){
+        for (index[2] = 0; index[2] < n_top_lvl_vxl[2]; index[2]++){
+          if (ctx.isAborted()){return;}
+          vxl_func(index);
+        }
       }
+      ctx.monitor.updateProgressBar(int(100*(double(index[0])+1)/double(n_top_lvl_vxl[0])));
+    }
+    return;
+  }
+
+  ThreadPool pool(_n_threads);
+  // estimate cost of every top level voxel, one slab per task
+  std::vector<std::pair<unsigned,std::array<unsigned,3>>> cost_list(totalVxlOnLvl(_max_depth));
+  for (unsigned x = 0; x < n_top_lvl_vxl[0]; ++x){
+    pool.submit([&, x](){
+      std::array<unsigned,3> index = {x,0,0};
+      for (index[1] = 0; index[1] < n_top_lvl_vxl[1]; index[1]++){
+        for (index[2] = 0; index[2] < n_top_lvl_vxl[2]; index[2]++){
+          cost_list[(index[2]*n_top_lvl_vxl[1] + index[1])*n_top_lvl_vxl[0] + index[0]] = {estimate_cost(index), index};
+        }
+      }
+    });
+  }
+  while (!pool.waitForTasks(std::chrono::milliseconds(100))){
+    ctx.monitor.updateCalculationStatus();
+  }
+  std::stable_sort(cost_list.begin(), cost_list.end(),
+      [](const auto& a, const auto& b){return a.first > b.first;});
+
+  // many small chunks keep the load balanced, while limiting the overhead of the pool
+  const unsigned long chunk_size = std::max(1ul, (unsigned long)(cost_list.size()/(64*_n_threads)));
+  unsigned long n_chunks = 0;
+  for (unsigned long first = 0; first < cost_list.size(); first += chunk_size){
+    const unsigned long last = std::min(first + chunk_size, (unsigned long)cost_list.size());
+    pool.submit([&, first, last](){
+      for (unsigned long i = first; i < last; ++i){
+        if (ctx.isAborted()){return;}
+        vxl_func(cost_list[i].second);
+      }
+    });
+    n_chunks++;
+  }
+  const unsigned long n_done_before = pool.getNumCompleted();
+  while (!pool.waitForTasks(std::chrono::milliseconds(100))){
+    ctx.monitor.updateCalculationStatus();
+    ctx.monitor.updateProgressBar(int(100*double(pool.getNumCompleted()-n_done_before)/double(n_chunks)));
+  }
+  ctx.monitor.updateProgressBar(100);
+}
+
+// calls func for each chunk of [0,n) and reports the progress of the step. the chunks are handed to the pool,
+// or evaluated in order by the calling thread, if there is no pool
+void Space::forEachChunk(const CalcContext& ctx, ThreadPool* pool, const unsigned long n, const unsigned long chunk_size,
+                         const std::function<void(unsigned long, unsigned long)>& func){
+  unsigned long n_chunks = 0;
+  const unsigned long n_done_before = pool? pool->getNumCompleted() : 0;
+  for (unsigned long first = 0; first < n; first += chunk_size){
+    const unsigned long last = std::min(first + chunk_size, n);
+    if (pool){pool->submit([&func, first, last](){func(first, last);});}
+    else {
+      ctx.monitor.updateCalculationStatus();
+      if (ctx.isAborted()){return;}
+      func(first, last);
+      ctx.monitor.updateProgressBar(int(100*double(last)/double(n)));
+    }
+    n_chunks++;
+  }
+  if (!pool){return;}
+  while (!pool->waitForTasks(std::chrono::milliseconds(100))){
+    ctx.monitor.updateCalculationStatus();
+    ctx.monitor.updateProgressBar(int(100*double(pool->getNumCompleted()-n_done_before)/double(n_chunks)));
+  }
+}
+
+// calls func(slab, worker) for each slab in [0,n_slabs), one task per slab. worker is the index of the thread that
+// evaluates the slab in [0,_n_threads), so that each thread adds to its own accumulator and the number of
+// accumulators does not depend on the size of the grid
+void Space::forEachSlab(const unsigned long n_slabs, const std::function<void(unsigned long, unsigned)>& func,
+                            const bool report_progress){
+  if (_n_threads <= 1){
+    for (unsigned long slab = 0; slab < n_slabs; ++slab){
+      _monitor->updateCalculationStatus();
+      if (isAborted()){break;}
+      func(slab, 0);
+      if (report_progress){_monitor->updateProgressBar(int(100*double(slab+1)/double(n_slabs)));}
+    }
+    return;
+  }
+  ThreadPool pool(_n_threads);
+  for (unsigned long slab = 0; slab < n_slabs; ++slab){
+    pool.submit([this, &func, slab](){
+      if (isAborted()){return;}
+      func(slab, ThreadPool::getWorkerIndex());
+    });
+  }
+  while (!pool.waitForTasks(std::chrono::milliseconds(100))){
+    _monitor->updateCalculationStatus();
+    if (report_progress){
+      _monitor->updateProgressBar(int(100*double(pool.getNumCompleted())/double(n_slabs)));
     }
-    Ctrl::getInstance()->updateProgressBar(int(100*(double(vxl_index[0])+1)/double(getGridsteps()[0])));
   }
 }
 
@@ -219,141 +468,140 @@ void Space::getVolume(std::map<char,double>& volumes, std::vector<Cavity>& cavit
   // clear all output variables
   volumes.clear();
   cavities.clear();
-  // create maps used for tallying voxels
-  std::map<char, unsigned> type_tally;
-  std::map<unsigned char, unsigned> id_core_tally;
-  std::map<unsigned char, unsigned> id_shell_tally;
-  // contain the boundaries in which all voxels of a given ID are contained
-  std::map<unsigned char, std::array<unsigned,3>> id_min;
-  std::map<unsigned char, std::array<unsigned,3>> id_max;
-  // set id 0 in maps for convenience when converting to vector
-  id_core_tally[0] = 0;
-  id_shell_tally[0] = 0;
-  for(char i = 0; i < 3; i++){
-    id_min[0][i] = 0;
-    id_max[0][i] = 0;
-  }
 
   // go through all top level voxels and search recursively for pure types. once found, each bottom level voxel
-  // adds 1 to the tally. at the same time the boundaries of the cavities are determined
-  std::array<unsigned,3> top_lvl_index;
-  for (top_lvl_index[0] = 0; top_lvl_index[0] < getGridsteps()[0]; top_lvl_index[0]++){
-    for (top_lvl_index[1] = 0; top_lvl_index[1] < getGridsteps()[1]; top_lvl_index[1]++){
-      for (top_lvl_index[2] = 0; top_lvl_index[2] < getGridsteps()[2]; top_lvl_index[2]++){
-        getTopVxl(top_lvl_index).tallyVoxelsOfType(type_tally, id_core_tally, id_shell_tally, id_min, id_max, top_lvl_index, _max_depth);
+  // adds 1 to the tally. at the same time the boundaries of the cavities are determined. each thread has its own
+  // tally, the counts are whole numbers, so the merged tally does not depend on the distribution of the slabs
+  const std::array<unsigned long,3> n_top_vxl = getGridsteps();
+  std::vector<VolumeTally> worker_tallies(std::max(1u, _n_threads));
+  forEachSlab(n_top_vxl[0], [&](const unsigned long slab, const unsigned worker){
+    std::array<unsigned,3> top_lvl_index = {(unsigned)slab, 0, 0};
+    for (top_lvl_index[1] = 0; top_lvl_index[1] < n_top_vxl[1]; top_lvl_index[1]++){
+      for (top_lvl_index[2] = 0; top_lvl_index[2] < n_top_vxl[2]; top_lvl_index[2]++){
+        getTopVxl(top_lvl_index).tallyVoxelsOfType(*this, worker_tallies[worker], top_lvl_index, _max_depth);
       }
     }
-  }
+  }, false);
+  VolumeTally tally;
+  for (const VolumeTally& worker_tally : worker_tallies){tally.merge(worker_tally);}
 
   // calculate the volume of a single bottom level voxel
   double unit_volume = pow(getVxlSize(),3);
   // convert from units of bottom level voxels to units of volume
-  for (auto& [type,tally] : type_tally) {
-    volumes[type] = tally * unit_volume;
-  }
-  // allocate memory
-  cavities = std::vector<Cavity> (id_core_tally.size()-1);
-  // convert from units of bottom level voxels to units of volume
+  tally.getVolumes(volumes, unit_volume);
   // convert from index to spatial coordinates
-  // copy values from map to vector for more efficient storage and access
   // ignore id == 0; this is not a cavity but all voxels that are neither core nor shell
-  for (auto& [id,tally] : id_core_tally) {
-    if (id == 0){continue;}
-    cavities[id-1].core_vol = tally * unit_volume;
-    cavities[id-1].shell_vol = id_shell_tally[id] * unit_volume;
-    cavities[id-1].id = id;
-    for (char i = 0; i < 3; ++i){
-      cavities[id-1].min_bound[i] = getOrigin()[i] + getVxlSize()*id_min[id][i];
-      cavities[id-1].max_bound[i] = getOrigin()[i] + getVxlSize()*(id_max[id][i]+1);
-      cavities[id-1].min_index[i] = id_min[id][i];
-      cavities[id-1].max_index[i] = id_max[id][i];
-    }
+  for (CavityID id = 1; id <= tally.getMaxID(); ++id) {
+    if (!tally.hasCore(id)){continue;}
+    cavities.push_back(makeCavity(tally, id, unit_volume));
   }
 }
 
+// cavity with the volumes and bounds of the tally
+Cavity Space::makeCavity(const VolumeTally& tally, const CavityID id, const double unit_volume){
+  std::array<double,3> min_arr;
+  std::array<double,3> max_arr;
+  for (char i = 0; i < 3; ++i){
+    min_arr[i] = getOrigin()[i] + getVxlSize()*tally.getMin(id)[i];
+    max_arr[i] = getOrigin()[i] + getVxlSize()*(tally.getMax(id)[i]+1);
+  }
+  return Cavity(id, tally.getCore(id)*unit_volume, tally.getShell(id)*unit_volume, min_arr, max_arr, tally.getMin(id), tally.getMax(id));
+}
+
 void Space::getUnitCellVolume(std::map<char,double>& volumes,
                               std::vector<Cavity>& cavities){
   // clear all output variables
   volumes.clear();
   cavities.clear();
-  // create maps used for tallying voxels
-  std::map<char, double> type_tally;
-  std::map<unsigned char, double> id_core_tally;
-  std::map<unsigned char, double> id_shell_tally;
-  // contain the boundaries in which all voxels of a given ID are contained
-  std::map<unsigned char, std::array<unsigned,3>> id_min;
-  std::map<unsigned char, std::array<unsigned,3>> id_max;
-
   std::vector<char> types_to_tally{0b00000011,0b00000101,0b00001001,0b00010001,0b00100001,0b01000001};
 
   setUnitCellIndexes();
 
-  // count bottom level voxels per type inside the unit cell
-  std::array<unsigned int,3> bot_lvl_index;
-  for (bot_lvl_index[0] = _unit_cell_start_index[0]; bot_lvl_index[0] < _unit_cell_end_index[0]; bot_lvl_index[0]++){
-    for (bot_lvl_index[1] = _unit_cell_start_index[1]; bot_lvl_index[1] < _unit_cell_end_index[1]; bot_lvl_index[1]++){
-      for (bot_lvl_index[2] = _unit_cell_start_index[2]; bot_lvl_index[2] < _unit_cell_end_index[2]; bot_lvl_index[2]++){
-        tallyVoxelsUnitCell(bot_lvl_index, 1, type_tally, id_core_tally, id_shell_tally, id_min, id_max);
-      }
-    }
-  }
-  // for unit cells that are not proportional to _grid_size, it is necessary to only consider a partial voxel volume for the voxels partially overlapping with the unit cell
+  // regions of bottom level voxels inside the unit cell. for unit cells that are not proportional to _grid_size, it
+  // is necessary to only consider a partial voxel volume for the voxels partially overlapping with the unit cell
+  struct TallyRegion{
+    std::array<unsigned,3> start;
+    std::array<unsigned,3> end;
+    double voxel_fraction;
+  };
+  std::vector<TallyRegion> regions;
+  regions.push_back({_unit_cell_start_index, _unit_cell_end_index, 1});
   for(int n = 0; n < 3; n++){
     int i = n;
     int j = (n+1)%3;
-    int k = (n+2)%3;
-
-    // count voxels in the three end faces of the unit cell
-    bot_lvl_index[i] = _unit_cell_end_index[i];
-    for (bot_lvl_index[j] = _unit_cell_start_index[j]; bot_lvl_index[j] < _unit_cell_end_index[j]; bot_lvl_index[j]++){
-      for (bot_lvl_index[k] = _unit_cell_start_index[k]; bot_lvl_index[k] < _unit_cell_end_index[k]; bot_lvl_index[k]++){
-        double voxel_fraction = _unit_cell_mod_index[i];
-        tallyVoxelsUnitCell(bot_lvl_index, voxel_fraction, type_tally, id_core_tally, id_shell_tally, id_min, id_max);
-      }
-    }
 
-    // count voxels in the three edges connecting end faces of the unit cell
-    bot_lvl_index[j] = _unit_cell_end_index[j];
-    for (bot_lvl_index[k] = _unit_cell_start_index[k]; bot_lvl_index[k] < _unit_cell_end_index[k]; bot_lvl_index[k]++){
-      double voxel_fraction = _unit_cell_mod_index[i]*_unit_cell_mod_index[j];
-      tallyVoxelsUnitCell(bot_lvl_index, voxel_fraction, type_tally, id_core_tally, id_shell_tally, id_min, id_max);
-    }
+    // voxels in the three end faces of the unit cell
+    TallyRegion face = {_unit_cell_start_index, _unit_cell_end_index, _unit_cell_mod_index[i]};
+    face.start[i] = _unit_cell_end_index[i];
+    face.end[i] = _unit_cell_end_index[i]+1;
+    regions.push_back(face);
+
+    // voxels in the three edges connecting end faces of the unit cell
+    TallyRegion edge = face;
+    edge.start[j] = _unit_cell_end_index[j];
+    edge.end[j] = _unit_cell_end_index[j]+1;
+    edge.voxel_fraction = _unit_cell_mod_index[i]*_unit_cell_mod_index[j];
+    regions.push_back(edge);
   }
-
-  // add last end vertex voxel
+  // last end vertex voxel
+  TallyRegion vertex = {_unit_cell_end_index, _unit_cell_end_index, _unit_cell_mod_index[0]*_unit_cell_mod_index[1]*_unit_cell_mod_index[2]};
   for(int i = 0; i < 3; i++){
-    bot_lvl_index[i] = _unit_cell_end_index[i];
+    vertex.end[i]++;
+  }
+  regions.push_back(vertex);
+
+  // whole voxels of a region within [first_x,last_x). the voxel fraction of the region is applied when the tally
+  // of the region is merged, so that the counts remain whole numbers
+  auto tallyRegion = [&](const TallyRegion& region, VolumeTally& tally, const unsigned first_x, const unsigned last_x){
+    const std::array<unsigned,3> start = {first_x, region.start[1], region.start[2]};
+    const std::array<unsigned,3> end = {last_x, region.end[1], region.end[2]};
+    // only the top level voxels that overlap with the region are descended into
+    std::array<unsigned,3> top_start;
+    std::array<unsigned,3> top_end;
+    for (char i = 0; i < 3; ++i){
+      top_start[i] = start[i] >> _max_depth;
+      top_end[i] = ((end[i]-1) >> _max_depth) + 1;
+    }
+    std::array<unsigned,3> top_index;
+    for (top_index[0] = top_start[0]; top_index[0] < top_end[0]; top_index[0]++){
+      for (top_index[1] = top_start[1]; top_index[1] < top_end[1]; top_index[1]++){
+        for (top_index[2] = top_start[2]; top_index[2] < top_end[2]; top_index[2]++){
+          getTopVxl(top_index).tallyVoxelsInBox(*this, tally, top_index, _max_depth, start, end);
+        }
+      }
+    }
+  };
+
+  // the inside of the unit cell is split into slabs one top level voxel wide, and each thread adds to its own
+  // tally. the counts are whole numbers, so the merged tally is exact. the partial voxels of the border regions
+  // are weighted by their fraction
+  const unsigned slab_width = 1u << _max_depth;
+  const TallyRegion& inside = regions[0];
+  std::vector<VolumeTally> worker_tallies(std::max(1u, _n_threads));
+  forEachSlab((inside.end[0] - inside.start[0] + slab_width - 1) / slab_width,
+              [&](const unsigned long slab, const unsigned worker){
+    const unsigned first_x = inside.start[0] + slab*slab_width;
+    tallyRegion(inside, worker_tallies[worker], first_x, std::min(first_x + slab_width, inside.end[0]));
+  }, false);
+  VolumeTally tally;
+  for (const VolumeTally& worker_tally : worker_tallies){tally.merge(worker_tally);}
+  for (size_t i = 1; i < regions.size(); ++i){
+    VolumeTally region_tally;
+    tallyRegion(regions[i], region_tally, regions[i].start[0], regions[i].end[0]);
+    tally.merge(region_tally, regions[i].voxel_fraction);
   }
-  double voxel_fraction = _unit_cell_mod_index[0]*_unit_cell_mod_index[1]*_unit_cell_mod_index[2];
-  tallyVoxelsUnitCell(bot_lvl_index, voxel_fraction, type_tally, id_core_tally, id_shell_tally, id_min, id_max);
 
   // calculate the volume of a single bottom level voxel
   double unit_volume = pow(_grid_size,3);
 
   for (size_t i = 0; i < types_to_tally.size(); i++){
-    volumes[types_to_tally[i]] = type_tally[types_to_tally[i]] * unit_volume;
+    volumes[types_to_tally[i]] = tally.getTypeVoxels(types_to_tally[i]) * unit_volume;
   }
   // convert from units of bottom level voxels to units of volume
   // convert from index to spatial coordinates
-  // copy values from map to vector for more efficient storage and access
-  std::array<double,3> min_arr = {0,0,0};
-  std::array<double,3> max_arr = {0,0,0};
-  std::array<unsigned int,3> min_index_arr = {0,0,0};
-  std::array<unsigned int,3> max_index_arr = {0,0,0};
-  for (auto& [id,tally] : id_core_tally) {
-    for (char i = 0; i < 3; ++i){
-      min_arr[i] = getOrigin()[i] + getVxlSize()*id_min[id][i];
-      max_arr[i] = getOrigin()[i] + getVxlSize()*(id_max[id][i]+1);
-      min_index_arr[i] = id_min[id][i];
-      max_index_arr[i] = id_max[id][i];
-    }
-    cavities.push_back(Cavity(id,
-                       tally*unit_volume,
-                       id_shell_tally[id] * unit_volume,
-                       min_arr,
-                       max_arr,
-                       min_index_arr,
-                       max_index_arr));
+  for (CavityID id = 0; id <= tally.getMaxID(); ++id) {
+    if (!tally.hasCore(id)){continue;}
+    cavities.push_back(makeCavity(tally, id, unit_volume));
   }
 }
 
@@ -368,221 +616,370 @@ void Space::setUnitCellIndexes(){
    }
 }
 
-void Space::tallyVoxelsUnitCell(std::array<unsigned int,3> bot_lvl_index,
-                                double voxel_fraction,
-                                std::map<char, double>& type_tally,
-                                std::map<unsigned char, double>& id_core_tally,
-                                std::map<unsigned char, double>& id_shell_tally,
-                                std::map<unsigned char, std::array<unsigned,3>>& id_min,
-                                std::map<unsigned char, std::array<unsigned,3>>& id_max){
-  // add voxel by type
-  type_tally[getVxlFromGrid(bot_lvl_index, 0).getType()] += voxel_fraction;
-  // add voxel by id and type
-  if(getVxlFromGrid(bot_lvl_index, 0).getType() == 0b00001001){
-    id_core_tally[getVxlFromGrid(bot_lvl_index, 0).getID()] += voxel_fraction;
-  }
-  else if(getVxlFromGrid(bot_lvl_index, 0).getType() == 0b00010001){
-    id_shell_tally[getVxlFromGrid(bot_lvl_index, 0).getID()] += voxel_fraction;
+//////////////////
+// SURFACE AREA //
+//////////////////
+
+// bit 0 of byte c of the word becomes bit c of the result. the multiplication shifts every byte's bit to its place
+// in the top byte without any carries
+static inline unsigned char gatherCornerBits(const uint64_t bytes){
+  return ((bytes & 0x0101010101010101ull) * 0x0102040810204080ull) >> 56;
+}
+
+// partial sums of the surface areas in units of the surface look up table. whole cubes are counted in integers,
+// the weighted cubes on the border of the unit cell in doubles
+template <class T>
+struct SurfaceTally{
+  std::vector<T> surfaces;
+  std::vector<T> surf_shell; // by cavity ID
+  std::vector<T> surf_core; // by cavity ID
+  std::array<const Voxel*,8> corners; // corner bit order of the marching cube: z + 2*y + 4*x
+  std::array<CavityID,8> ids; // cavity IDs of the corners, valid for the bits set in ids_loaded
+  unsigned char ids_loaded = 0;
+  // the last leaf whose ID was looked up in each of the 4 rows of corners along x, in the order z + 2*y
+  struct Leaf{
+    std::array<unsigned,3> index;
+    int lvl = -1;
+    CavityID id;
+  };
+  std::array<Leaf,4> rows;
+};
+
+// surfaces of the whole structure for each set of solid types, and the shell and core surfaces of all cavities, in a
+// single sweep over the bottom level. the 8 voxels of a marching cube are read once, and the configurations of all
+// sets are built from a mask of the sets that contain the type of each voxel. a cavity surface only includes the
+// voxels with the ID of the cavity, so each cavity found in a cube is added to its own accumulator. the areas are
+// summed in whole units of the surface look up table, so the sums are exact regardless of the order of the cubes
+void Space::calcSurfAreas(const std::vector<std::vector<char>>& solid_types,
+                          const std::vector<char>& shell_types,
+                          const std::vector<char>& core_types,
+                          std::vector<double>& surfaces,
+                          std::vector<Cavity>& cavities){
+  // one bit per set of solid types, followed by the cavity shell and core
+  const size_t n_sets = solid_types.size();
+  const unsigned shell_pos = n_sets;
+  const unsigned core_pos = n_sets+1;
+  assert(core_pos < 8 && "set masks are limited to one byte");
+  std::array<unsigned char,256> set_mask = {};
+  for (size_t s = 0; s < n_sets; ++s){
+    for (const char type : solid_types[s]){set_mask[(unsigned char)type] |= 1u << s;}
   }
-  // set cavity min/max indexes
-  if (id_min.count(getVxlFromGrid(bot_lvl_index, 0).getID()) == 0){
-    id_min[getVxlFromGrid(bot_lvl_index, 0).getID()] = bot_lvl_index;
+  for (const char type : shell_types){set_mask[(unsigned char)type] |= 1u << shell_pos;}
+  for (const char type : core_types){set_mask[(unsigned char)type] |= 1u << core_pos;}
+
+  // accumulators by cavity ID
+  CavityID max_id = 0;
+  for (const Cavity& cav : cavities){max_id = std::max(max_id, cav.id);}
+  std::vector<bool> listed(max_id+1, false);
+  for (const Cavity& cav : cavities){listed[cav.id] = true;}
+
+  auto loadCorners = [&](auto& tally, const std::array<unsigned,3>& index, const char first_x){
+    for (char x = first_x; x < 2; ++x){
+      for (char y = 0; y < 2; ++y){
+        for (char z = 0; z < 2; ++z){
+          const char c = z + 2*y + 4*x;
+          tally.corners[c] = &getResolvedVxl(std::array<unsigned,3>{index[0]+x, index[1]+y, index[2]+z}, 0);
+          setBitOff(tally.ids_loaded, c);
+        }
+      }
+    }
+  };
+  // the cavity IDs are stored by leaf, so the corners are resolved to their leaves first. consecutive cubes of a row
+  // mostly lie in the same leaves, so a row of corners only resolves its leaf again once it leaves the previous one.
+  // this matters in a sparse octree, where every look up descends from the top level
+  auto loadIDs = [&](auto& tally, const std::array<unsigned,3>& index){
+    for (char c = 0; c < 8; ++c){
+      if (readBit(tally.ids_loaded, c)){continue;}
+      setBitOn(tally.ids_loaded, c);
+      tally.ids[c] = 0;
+      if (!(tally.corners[c]->getType() & 0b00011000)){continue;}
+      const std::array<unsigned,3> corner = {index[0] + ((c>>2)&1), index[1] + ((c>>1)&1), index[2] + (c&1)};
+      auto& leaf = tally.rows[c & 3];
+      if (leaf.lvl < 0 || (corner[0] >> leaf.lvl) != leaf.index[0]
+          || (corner[1] >> leaf.lvl) != leaf.index[1] || (corner[2] >> leaf.lvl) != leaf.index[2]){
+        leaf.index = corner;
+        leaf.lvl = 0;
+        resolveLeaf(leaf.index, leaf.lvl);
+        leaf.id = _cavity_ids->get(leaf.index, leaf.lvl);
+      }
+      tally.ids[c] = leaf.id;
+    }
+  };
+  // the set masks of the 8 corners are packed into the bytes of a word, so that the configuration of a set is
+  // gathered from one bit of every byte
+  auto addCube = [&](auto& tally, const std::array<unsigned,3>& index, const auto weight){
+    uint64_t masks = 0;
+    char types_and = ~0;
+    char types_or = 0;
+    for (char c = 0; c < 8; ++c){
+      const char type = tally.corners[c]->getType();
+      masks |= uint64_t(set_mask[(unsigned char)type]) << (8*c);
+      types_and &= type;
+      types_or |= type;
+    }
+    // all configurations are either empty or full. touching core leaves always belong to the same cavity, so
+    // only a cube of shell may still have a cavity surface, if its corners belong to different cavities
+    if (masks == (masks & 0xFF) * 0x0101010101010101ull){
+      if (types_and == types_or && !readBit(types_or,4)){return;}
+      loadIDs(tally, index);
+      bool same_ids = true;
+      for (char c = 1; c < 8; ++c){same_ids &= tally.ids[c] == tally.ids[0];}
+      if (same_ids){return;}
+    }
+    else {loadIDs(tally, index);}
+    for (size_t s = 0; s < n_sets; ++s){
+      tally.surfaces[s] += SurfaceLUT::configToUnits(gatherCornerBits(masks >> s)) * weight;
+    }
+    for (char c = 0; c < 8; ++c){
+      const CavityID id = tally.ids[c];
+      if (id > max_id || !listed[id]){continue;}
+      bool seen = false;
+      for (char k = 0; k < c; ++k){seen |= tally.ids[k] == id;}
+      if (seen){continue;}
+      uint64_t same_id = 0;
+      for (char k = 0; k < 8; ++k){same_id |= uint64_t(tally.ids[k] == id) << (8*k);}
+      tally.surf_shell[id] += SurfaceLUT::configToUnits(gatherCornerBits((masks >> shell_pos) & same_id)) * weight;
+      tally.surf_core[id] += SurfaceLUT::configToUnits(gatherCornerBits((masks >> core_pos) & same_id)) * weight;
+    }
+  };
+  // the cubes of the box [box_start,box_end), one row along x at a time
+  auto addBox = [&](SurfaceTally<uint64_t>& tally, const std::array<unsigned,3>& box_start, const std::array<unsigned,3>& box_end){
+    std::array<unsigned,3> index;
+    for (index[2] = box_start[2]; index[2] < box_end[2]; index[2]++){
+      for (index[1] = box_start[1]; index[1] < box_end[1]; index[1]++){
+        index[0] = box_start[0];
+        loadCorners(tally, index, 0);
+        for (; index[0] < box_end[0]; index[0]++){
+          // the 4 voxels at x+1 of the previous cube are the voxels at x of this cube
+          if (index[0] != box_start[0]){
+            std::copy(tally.corners.begin()+4, tally.corners.end(), tally.corners.begin());
+            std::copy(tally.ids.begin()+4, tally.ids.end(), tally.ids.begin());
+            tally.ids_loaded >>= 4;
+            loadCorners(tally, index, 1);
+          }
+          addCube(tally, index, uint64_t(1));
+        }
+      }
+    }
+  };
+
+  std::array<unsigned,3> start_index = _unit_cell? _unit_cell_start_index : std::array<unsigned,3>({0,0,0});
+  std::array<unsigned,3> end_index = _unit_cell_end_index;
+  if (!_unit_cell){
+    const std::array<unsigned long,3> n_elements = getGridstepsOnLvl(0);
+    for(char i = 0; i < 3; i++){end_index[i] = n_elements[i];}
   }
-  if (id_max.count(getVxlFromGrid(bot_lvl_index, 0).getID()) == 0){
-    id_max[getVxlFromGrid(bot_lvl_index, 0).getID()] = bot_lvl_index;
+  // the cubes start at all voxels within range minus one in each direction because the +1 neighbors are part of the cube
+  std::array<unsigned,3> cube_end;
+  for (char i = 0; i < 3; ++i){cube_end[i] = end_index[i]-1;}
+
+  // each thread adds the whole cubes of its slabs to its own tally. the sums are exact, so the result does not
+  // depend on the distribution of the slabs
+  const std::array<unsigned long,3> n_top_vxl = getGridsteps();
+  std::vector<SurfaceTally<uint64_t>> worker_tallies(std::max(1u, _n_threads));
+  for (SurfaceTally<uint64_t>& tally : worker_tallies){
+    tally.surfaces.assign(n_sets, 0);
+    tally.surf_shell.assign(max_id+1, 0);
+    tally.surf_core.assign(max_id+1, 0);
   }
-  for (char i = 0; i < 3; i++){
-    if (id_min[getVxlFromGrid(bot_lvl_index, 0).getID()][i] > bot_lvl_index[i]){
-      id_min[getVxlFromGrid(bot_lvl_index, 0).getID()][i] = bot_lvl_index[i];
+  forEachSlab(n_top_vxl[2], [&](const unsigned long slab, const unsigned worker){
+    SurfaceTally<uint64_t>& tally = worker_tallies[worker];
+    std::array<unsigned,3> top_index = {0, 0, (unsigned)slab};
+    for (top_index[1] = 0; top_index[1] < n_top_vxl[1]; top_index[1]++){
+      if (isAborted()){return;}
+      for (top_index[0] = 0; top_index[0] < n_top_vxl[0]; top_index[0]++){
+        forEachSurfaceBox(getTopVxl(top_index), top_index, _max_depth, start_index, cube_end,
+                          [&](const std::array<unsigned,3>& box_start, const std::array<unsigned,3>& box_end){
+          addBox(tally, box_start, box_end);
+        });
+      }
     }
-    if (id_max[getVxlFromGrid(bot_lvl_index, 0).getID()][i] < bot_lvl_index[i]){
-      id_max[getVxlFromGrid(bot_lvl_index, 0).getID()][i] = bot_lvl_index[i];
+  }, true);
+  if (isAborted()){return;}
+
+  SurfaceTally<uint64_t>& sum = worker_tallies[0];
+  for (size_t worker = 1; worker < worker_tallies.size(); ++worker){
+    for (size_t s = 0; s < n_sets; ++s){sum.surfaces[s] += worker_tallies[worker].surfaces[s];}
+    for (const Cavity& cav : cavities){
+      sum.surf_shell[cav.id] += worker_tallies[worker].surf_shell[cav.id];
+      sum.surf_core[cav.id] += worker_tallies[worker].surf_core[cav.id];
     }
   }
-}
+  // the cubes on the border of the unit cell only add a fraction of their area
+  SurfaceTally<double> total;
+  total.surfaces.assign(sum.surfaces.begin(), sum.surfaces.end());
+  total.surf_shell.assign(sum.surf_shell.begin(), sum.surf_shell.end());
+  total.surf_core.assign(sum.surf_core.begin(), sum.surf_core.end());
+  if (_unit_cell){
+    forEachUnitCellBorderCube([&](const std::array<unsigned,3>& cube_index, const double weight){
+      loadCorners(total, cube_index, 0);
+      addCube(total, cube_index, weight);
+    });
+  }
 
-//////////////////
-// SURFACE AREA //
-//////////////////
+  // scale the surface areas from units of the look up table to squared gridstep units
+  const double unit_area = _grid_size*_grid_size / SurfaceLUT::s_units_per_area;
+  surfaces = total.surfaces;
+  for (double& surface : surfaces){surface *= unit_area;}
+  for (Cavity& cav : cavities){
+    cav.surf_shell = total.surf_shell[cav.id] * unit_area;
+    cav.surf_core = total.surf_core[cav.id] * unit_area;
+  }
+}
 
-// overloaded for full molecule surfaces
-// sets the appropriate start and end indices
-double Space::calcSurfArea(const std::vector<char>& types){
-  std::array<unsigned,3> start_index = _unit_cell? _unit_cell_start_index : std::array<unsigned,3>({0,0,0});
-  std::array<unsigned,3> end_index   = _unit_cell? _unit_cell_end_index   : getGrid(0).getNumElements<unsigned>();
-  double surface = tallySurface(types, start_index, end_index);
-  // scale the surface area in squared gridstep units
-  return (surface * (_grid_size*_grid_size));
-}
-
-// overload for cavity surfaces
-// solid types MUST also have appropriate ID!
-double Space::calcSurfArea(const std::vector<char>& types, const unsigned char id, std::array<unsigned int,3> start_index, std::array<unsigned int,3> end_index){
-  if(Ctrl::getInstance()->getAbortFlag()){return 0;}
-  // the surface area is counted between voxels, thus we need to check voxels around the limits of the cavity
-  if(!_unit_cell){
-    for(char i = 0; i < 3; i++){
-      std::array<unsigned long,3> n_elements = getGrid(0).getNumElements();
-      if(start_index[i] > 0){start_index[i]--;}
-      // increase end_index twice because it should be above the range of indexes checked like vector and array sizes in C++
-      if(end_index[i] < n_elements[i]){end_index[i]++;}
-      if(end_index[i] < n_elements[i]){end_index[i]++;}
-    }
-  }
-  // for unit cell analysis, surfaces outside the unit cell should not be included
-  else{
-    for(char i = 0; i < 3; i++){
-      if(start_index[i] > _unit_cell_start_index[i]){start_index[i]--;}
-      // increase end_index twice because it should be above the range of indexes checked like vector and array sizes in C++
-      if(end_index[i] < _unit_cell_end_index[i]){end_index[i]++;}
-      if(end_index[i] < _unit_cell_end_index[i]){end_index[i]++;}
-    }
-  }
-  double surface = tallySurface(types, start_index, end_index, id, true);
-  // scale the surface area in squared gridstep units
-  return (surface * (_grid_size*_grid_size));
-}
-
-double Space::tallySurface(const std::vector<char>& types, std::array<unsigned int,3>& start_index, std::array<unsigned int,3>& end_index, const unsigned char id, const bool cavity){
-  double surface = 0;
-
-  // loop over all voxels within range minus one in each direction because the +1 neighbors will be checked at the same time
-  std::array<unsigned int,3> index;
-  Ctrl::getInstance()->updateCalculationStatus();
-  for(index[2] = start_index[2]; index[2] < end_index[2]-1; index[2]++){
-    for(index[1] = start_index[1]; index[1] < end_index[1]-1; index[1]++){
-      if(Ctrl::getInstance()->getAbortFlag()){return 0;}
-      for(index[0] = start_index[0]; index[0] < end_index[0]-1; index[0]++){
-        surface += SurfaceLUT::configToArea(evalMarchingCubeConfig(index, types, id, cavity));
-      }
+// the cubes of a voxel are the cubes whose first corner lies inside of it. if the voxel is pure, the cubes that lie
+// completely inside of it have 8 corners with the same type and ID, which are not part of any surface. only the
+// cubes on its 3 upper faces reach into its neighbours. they are passed on as boxes, unless the 7 upper neighbours
+// on the same level are pure as well and have the same type and ID. the cost is therefore proportional to the
+// number of leaves and the size of the surfaces, rather than to the volume of the grid. boxes are clipped to the
+// cube indexes [start,end)
+void Space::forEachSurfaceBox(Voxel& vxl, const std::array<unsigned,3>& index, const int lvl,
+                              const std::array<unsigned,3>& start, const std::array<unsigned,3>& end,
+                              const std::function<void(const std::array<unsigned,3>&, const std::array<unsigned,3>&)>& func){
+  // first and last bottom level index covered by the voxel
+  const unsigned edge = 1u << lvl;
+  std::array<unsigned,3> first;
+  std::array<unsigned,3> last;
+  for (char i = 0; i < 3; ++i){
+    first[i] = index[i] * edge;
+    last[i] = first[i] + edge - 1;
+    if (last[i] < start[i] || first[i] >= end[i]){return;}
+  }
+  if (vxl.hasSubvoxel()){
+    for (char j = 0; j < 8; ++j){
+      const std::array<unsigned,3> sub_index = {index[0]*2 + (j&1), index[1]*2 + ((j>>1)&1), index[2]*2 + ((j>>2)&1)};
+      forEachSurfaceBox(vxl.getSubvoxel(*this, index, lvl, j), sub_index, lvl-1, start, end, func);
     }
+    return;
   }
-  if(_unit_cell){
-    /* the surface area is counted between voxels, thus the borders of the unit cell should include partial surface area by configuration
-    since the surface area is not homogeneous over the voxel, the surface area from the borders will be an approximation
-    -1,-1,-1 *1/8 on 1 vertex
-    -1,-1,i  *1/4 on 3 edges
-    -1,i,i   *1/2 on 3 faces
-    -1,n,i   *((1/4)+(mod/2)) on 6 edges
-    -1,-1,n  *((1/8)+(mod/4)) on 3 vertices
-    -1,n,n   *((1/8)+(modA/4)+(modB/4)+(modA*modB/2)) on 3 vertices
-    n,i,i    *((1/2)+mod) on 3 faces
-    n,n,i    *((1/4)+(modA/2)+(modB/2)+(modA*modB)) on 3 edges
-    n,n,n    *((1/8)+(modA/4)+(modB/4)+(modC/4)+(modA*modB/2)+(modA*modC/2)+(modB*modC/2)+(modA*modB*modC)) on 1 vertex
-    */
-
-    // add first -1,-1,-1 vertex
-    for(int i = 0; i < 3; i++){
-      index[i] = _unit_cell_start_index[i]-1;
-    }
-    surface += (SurfaceLUT::configToArea(evalMarchingCubeConfig(index, types, id, cavity)) * 0.125);
-
-    // add last n,n,n vertex
-    for(int i = 0; i < 3; i++){
-      index[i] = _unit_cell_end_index[i]-1;
-    }
-    surface += (SurfaceLUT::configToArea(evalMarchingCubeConfig(index, types, id, cavity)) *
-                (0.125 +
-                 ((_unit_cell_mod_index[0] + _unit_cell_mod_index[1] + _unit_cell_mod_index[2])/4) +
-                 (_unit_cell_mod_index[0] * _unit_cell_mod_index[1]/2) +
-                 (_unit_cell_mod_index[0] * _unit_cell_mod_index[2]/2) +
-                 (_unit_cell_mod_index[1] * _unit_cell_mod_index[2]/2) +
-                 (_unit_cell_mod_index[0] * _unit_cell_mod_index[1] * _unit_cell_mod_index[2])));
-
-    // swap x,y,z
-    for(int n = 0; n < 3; n++){
-      int i = n;
-      int j = (n+1)%3;
-      int k = (n+2)%3;
-
-      // add the first three intermediate vertices -1,-1,n
-      index[i] = _unit_cell_start_index[i]-1;
-      index[j] = _unit_cell_start_index[j]-1;
-      index[k] = _unit_cell_end_index[k]-1;
-      surface += (SurfaceLUT::configToArea(evalMarchingCubeConfig(index, types, id, cavity)) * (0.125 + (_unit_cell_mod_index[k]/4)));
-
-      // add the last three intermediate vertices -1,n,n
-      index[i] = _unit_cell_start_index[i]-1;
-      index[j] = _unit_cell_end_index[j]-1;
-      index[k] = _unit_cell_end_index[k]-1;
-      surface += (SurfaceLUT::configToArea(evalMarchingCubeConfig(index, types, id, cavity)) *
-                  (0.125 +
-                   ((_unit_cell_mod_index[j] + _unit_cell_mod_index[k])/4) +
-                   (_unit_cell_mod_index[j] * _unit_cell_mod_index[k]/2)));
-
-      // add the three start edges -1,-1,k
-      index[i] = _unit_cell_start_index[i]-1;
-      index[j] = _unit_cell_start_index[j]-1;
-      for (index[k] = _unit_cell_start_index[k]; index[k] < _unit_cell_end_index[k]-1; index[k]++){
-        surface += (SurfaceLUT::configToArea(evalMarchingCubeConfig(index, types, id, cavity)) * 0.25);
-      }
+  // neighbours outside of the grid only touch cubes outside of the range
+  // touching core leaves always belong to the same cavity, so only shell leaves compare their cavity IDs. the
+  // voxel is a leaf, so its ID is read from the table directly, while the neighbours are resolved to their leaves
+  const std::array<unsigned long,3> n_vxl = getGridstepsOnLvl(lvl);
+  const bool is_shell = readBit(vxl.getType(),4);
+  const CavityID id = is_shell? _cavity_ids->get(index, lvl) : 0;
+  bool uniform = true;
+  for (char j = 1; j < 8 && uniform; ++j){
+    std::array<unsigned,3> nb_index = {index[0] + (j&1), index[1] + ((j>>1)&1), index[2] + ((j>>2)&1)};
+    if (nb_index[0] >= n_vxl[0] || nb_index[1] >= n_vxl[1] || nb_index[2] >= n_vxl[2]){continue;}
+    const Voxel& nb = getResolvedVxl(nb_index, lvl);
+    uniform = !nb.hasSubvoxel() && nb.getType() == vxl.getType();
+    if (uniform && is_shell){
+      int nb_lvl = lvl;
+      resolveLeaf(nb_index, nb_lvl);
+      uniform = _cavity_ids->get(nb_index, nb_lvl) == id;
+    }
+  }
+  if (uniform){return;}
+  auto clipBox = [&](std::array<unsigned,3> box_start, std::array<unsigned,3> box_end){
+    for (char i = 0; i < 3; ++i){
+      box_start[i] = std::max(box_start[i], start[i]);
+      box_end[i] = std::min(box_end[i], end[i]);
+      if (box_start[i] >= box_end[i]){return;}
+    }
+    func(box_start, box_end);
+  };
+  // upper x face, upper y face without the x edge, upper z face without the x and y edges
+  clipBox({last[0], first[1], first[2]}, {last[0]+1, last[1]+1, last[2]+1});
+  clipBox({first[0], last[1], first[2]}, {last[0], last[1]+1, last[2]+1});
+  clipBox({first[0], first[1], last[2]}, {last[0], last[1], last[2]+1});
+}
 
-      // add the three end edges n,n,k
-      index[i] = _unit_cell_end_index[i]-1;
-      index[j] = _unit_cell_end_index[j]-1;
-      for (index[k] = _unit_cell_start_index[k]; index[k] < _unit_cell_end_index[k]-1; index[k]++){
-        surface += (SurfaceLUT::configToArea(evalMarchingCubeConfig(index, types, id, cavity)) *
-                    (0.25 +
-                     ((_unit_cell_mod_index[j] + _unit_cell_mod_index[k])/2) +
-                     (_unit_cell_mod_index[j] * _unit_cell_mod_index[k])));
-      }
+/* the surface area is counted between voxels, thus the borders of the unit cell should include partial surface area by configuration
+since the surface area is not homogeneous over the voxel, the surface area from the borders will be an approximation
+-1,-1,-1 *1/8 on 1 vertex
+-1,-1,i  *1/4 on 3 edges
+-1,i,i   *1/2 on 3 faces
+-1,n,i   *((1/4)+(mod/2)) on 6 edges
+-1,-1,n  *((1/8)+(mod/4)) on 3 vertices
+-1,n,n   *((1/8)+(modA/4)+(modB/4)+(modA*modB/2)) on 3 vertices
+n,i,i    *((1/2)+mod) on 3 faces
+n,n,i    *((1/4)+(modA/2)+(modB/2)+(modA*modB)) on 3 edges
+n,n,n    *((1/8)+(modA/4)+(modB/4)+(modC/4)+(modA*modB/2)+(modA*modC/2)+(modB*modC/2)+(modA*modB*modC)) on 1 vertex
+*/
+void Space::forEachUnitCellBorderCube(const std::function<void(const std::array<unsigned,3>&, const double)>& func){
+  std::array<unsigned,3> index;
+  // add first -1,-1,-1 vertex
+  for(int i = 0; i < 3; i++){
+    index[i] = _unit_cell_start_index[i]-1;
+  }
+  func(index, 0.125);
 
-      // add the three start faces -1,j,k
-      index[i] = _unit_cell_start_index[i]-1;
-      for (index[j] = _unit_cell_start_index[j]; index[j] < _unit_cell_end_index[j]-1; index[j]++){
-        for (index[k] = _unit_cell_start_index[k]; index[k] < _unit_cell_end_index[k]-1; index[k]++){
-          surface += (SurfaceLUT::configToArea(evalMarchingCubeConfig(index, types, id, cavity)) * 0.5);
-        }
-      }
+  // add last n,n,n vertex
+  for(int i = 0; i < 3; i++){
+    index[i] = _unit_cell_end_index[i]-1;
+  }
+  func(index, (0.125 +
+               ((_unit_cell_mod_index[0] + _unit_cell_mod_index[1] + _unit_cell_mod_index[2])/4) +
+               (_unit_cell_mod_index[0] * _unit_cell_mod_index[1]/2) +
+               (_unit_cell_mod_index[0] * _unit_cell_mod_index[2]/2) +
+               (_unit_cell_mod_index[1] * _unit_cell_mod_index[2]/2) +
+               (_unit_cell_mod_index[0] * _unit_cell_mod_index[1] * _unit_cell_mod_index[2])));
+
+  // swap x,y,z
+  for(int n = 0; n < 3; n++){
+    int i = n;
+    int j = (n+1)%3;
+    int k = (n+2)%3;
 
-      // add the three end faces n,j,k
-      index[i] = _unit_cell_end_index[i]-1;
-      for (index[j] = _unit_cell_start_index[j]; index[j] < _unit_cell_end_index[j]-1; index[j]++){
-        for (index[k] = _unit_cell_start_index[k]; index[k] < _unit_cell_end_index[k]-1; index[k]++){
-          surface += (SurfaceLUT::configToArea(evalMarchingCubeConfig(index, types, id, cavity)) * (0.5 + _unit_cell_mod_index[i]));
-        }
-      }
+    // add the first three intermediate vertices -1,-1,n
+    index[i] = _unit_cell_start_index[i]-1;
+    index[j] = _unit_cell_start_index[j]-1;
+    index[k] = _unit_cell_end_index[k]-1;
+    func(index, (0.125 + (_unit_cell_mod_index[k]/4)));
+
+    // add the last three intermediate vertices -1,n,n
+    index[i] = _unit_cell_start_index[i]-1;
+    index[j] = _unit_cell_end_index[j]-1;
+    index[k] = _unit_cell_end_index[k]-1;
+    func(index, (0.125 +
+                 ((_unit_cell_mod_index[j] + _unit_cell_mod_index[k])/4) +
+                 (_unit_cell_mod_index[j] * _unit_cell_mod_index[k]/2)));
+
+    // add the three start edges -1,-1,k
+    index[i] = _unit_cell_start_index[i]-1;
+    index[j] = _unit_cell_start_index[j]-1;
+    for (index[k] = _unit_cell_start_index[k]; index[k] < _unit_cell_end_index[k]-1; index[k]++){
+      func(index, 0.25);
+    }
 
-      // add the six intermediate edges -1,n,k and n,-1,k
-      index[i] = _unit_cell_start_index[i]-1;
-      index[j] = _unit_cell_end_index[j]-1;
+    // add the three end edges n,n,k
+    index[i] = _unit_cell_end_index[i]-1;
+    index[j] = _unit_cell_end_index[j]-1;
+    for (index[k] = _unit_cell_start_index[k]; index[k] < _unit_cell_end_index[k]-1; index[k]++){
+      func(index, (0.25 +
+                   ((_unit_cell_mod_index[j] + _unit_cell_mod_index[k])/2) +
+                   (_unit_cell_mod_index[j] * _unit_cell_mod_index[k])));
+    }
+
+    // add the three start faces -1,j,k
+    index[i] = _unit_cell_start_index[i]-1;
+    for (index[j] = _unit_cell_start_index[j]; index[j] < _unit_cell_end_index[j]-1; index[j]++){
       for (index[k] = _unit_cell_start_index[k]; index[k] < _unit_cell_end_index[k]-1; index[k]++){
-        surface += (SurfaceLUT::configToArea(evalMarchingCubeConfig(index, types, id, cavity)) * (0.25 + (_unit_cell_mod_index[j]/2)));
+        func(index, 0.5);
       }
-      index[i] = _unit_cell_end_index[i]-1;
-      index[j] = _unit_cell_start_index[j]-1;
+    }
+
+    // add the three end faces n,j,k
+    index[i] = _unit_cell_end_index[i]-1;
+    for (index[j] = _unit_cell_start_index[j]; index[j] < _unit_cell_end_index[j]-1; index[j]++){
       for (index[k] = _unit_cell_start_index[k]; index[k] < _unit_cell_end_index[k]-1; index[k]++){
-        surface += (SurfaceLUT::configToArea(evalMarchingCubeConfig(index, types, id, cavity)) * (0.25 + (_unit_cell_mod_index[i]/2)));
+        func(index, (0.5 + _unit_cell_mod_index[i]));
       }
     }
-  }
-  return surface;
-}
 
-bool isSolid(const Voxel&, const std::vector<char>&);
-
-unsigned char Space::evalMarchingCubeConfig(const std::array<unsigned int,3>& index, const std::vector<char>& types, const unsigned char id, const bool cavity){
-  unsigned char config = 0; // configuration of the marching cube stored as a byte
-  // check the starting voxel and its 7 neighbors to define a marching cube configuration
-  std::array<unsigned,3> subindex;
-  for(unsigned int x = 0; x < 2; x++){
-    subindex[0] = index[0] + x;
-    for(unsigned int y = 0; y < 2; y++){
-      subindex[1] = index[1] + y;
-      for(unsigned int z = 0; z < 2; z++){
-        subindex[2] = index[2] + z;
-        // condition for a bit to be true in the byte
-        bool bit_state = isSolid(getVxlFromGrid(subindex, 0), types);
-        if (cavity) {bit_state &= getVxlFromGrid(subindex, 0).getID() == id;}
-        setBit(config, z + 2*y + 4*x, bit_state);
-      }
+    // add the six intermediate edges -1,n,k and n,-1,k
+    index[i] = _unit_cell_start_index[i]-1;
+    index[j] = _unit_cell_end_index[j]-1;
+    for (index[k] = _unit_cell_start_index[k]; index[k] < _unit_cell_end_index[k]-1; index[k]++){
+      func(index, (0.25 + (_unit_cell_mod_index[j]/2)));
+    }
+    index[i] = _unit_cell_end_index[i]-1;
+    index[j] = _unit_cell_start_index[j]-1;
+    for (index[k] = _unit_cell_start_index[k]; index[k] < _unit_cell_end_index[k]-1; index[k]++){
+      func(index, (0.25 + (_unit_cell_mod_index[i]/2)));
     }
   }
-  return config;
-}
-
-inline bool isSolid(const Voxel& vxl, const std::vector<char>& solid_types){
-  return std::find(solid_types.begin(), solid_types.end(), vxl.getType()) != solid_types.end();
 }
 
 //////////////////////
@@ -613,28 +1010,82 @@ double Space::getVxlSize() const {
   return _grid_size;
 }
 
-Container3D<Voxel>& Space::getGrid(const unsigned lvl){
-  return _grid[lvl];
-}
-
 /////////////////
 // GET ELEMENT //
 /////////////////
 
 Voxel& Space::getVxlFromGrid(const unsigned int i, unsigned lvl){
+  if (_subvoxels && int(lvl) < _max_depth){
+    const std::array<unsigned long,3> n_vxl = getGridstepsOnLvl(lvl);
+    return getVxlFromGrid(i%n_vxl[0], (i/n_vxl[0])%n_vxl[1], i/(n_vxl[0]*n_vxl[1]), lvl);
+  }
   return _grid[lvl].getElement(i);
 }
 
 Voxel& Space::getVxlFromGrid(const unsigned int x, const unsigned int y, const unsigned int z, unsigned lvl){
-  return _grid[lvl].getElement(x,y,z);
+  return getVxlFromGrid(std::array<unsigned int,3>{x,y,z}, lvl);
 }
 
+// in a sparse octree, only subvoxels of split voxels exist. these are the only ones that are written to
+// with lazy inheritance. all other voxels must be read through resolveVxl
 Voxel& Space::getVxlFromGrid(const std::array<unsigned int,3> arr, unsigned lvl){
+  if (_subvoxels && int(lvl) < _max_depth){
+    int res_lvl = lvl;
+    std::array<unsigned int,3> res_index = arr;
+    Voxel& vxl = resolveVxl(res_index, res_lvl);
+    if (res_lvl != int(lvl)){throw std::logic_error("subvoxel has not been allocated");}
+    return vxl;
+  }
   return _grid[lvl].getElement(arr);
 }
 
 Voxel& Space::getVxlFromGrid(const std::array<int,3> arr, unsigned lvl){
-  return _grid[lvl].getElement(arr);
+  return getVxlFromGrid(std::array<unsigned int,3>{(unsigned)arr[0], (unsigned)arr[1], (unsigned)arr[2]}, lvl);
+}
+
+// centre of the top level voxel
+Vector Space::calcTopVxlPos(const std::array<unsigned,3>& top_lvl_index){
+  const std::array<double,3> vxl_origin = getOrigin();
+  const double vxl_dist = _grid_size * pow(2,_max_depth);
+  Vector vxl_pos;
+  for (char i = 0; i < 3; ++i){
+    vxl_pos[i] = vxl_origin[i] + vxl_dist * (0.5 + top_lvl_index[i]);
+  }
+  return vxl_pos;
+}
+
+// walks from the top level down to the voxel at index and lvl and returns the link to its subvoxels
+std::atomic<SubvoxelPool::Link>* Space::findSubvoxelLink(std::array<unsigned,3>& index, int& lvl, const int target_lvl){
+  const int shift = _max_depth-target_lvl;
+  const std::array<unsigned,3> top_index = {index[0] >> shift, index[1] >> shift, index[2] >> shift};
+  std::atomic<SubvoxelPool::Link>* link = &_subvoxels->getTopLink(top_index);
+  for (lvl = _max_depth; lvl > target_lvl; --lvl){
+    const SubvoxelPool::Link block = link->load(std::memory_order_acquire);
+    if (block == 0){return nullptr;}
+    const int bit = lvl-target_lvl-1;
+    char octant = 0;
+    for (char i = 0; i < 3; ++i){
+      octant |= ((index[i] >> bit) & 1) << i;
+    }
+    link = &_subvoxels->getBlock(block).sub[octant];
+  }
+  return link;
+}
+
+// called once, when a voxel is split for the first time. all 8 subvoxels start out with the type of their
+// parent. the subvoxels become visible to other threads only after they have been initialised
+void Space::allocateSubvoxels(const std::array<unsigned,3>& index, const int lvl, const Voxel& init){
+  std::array<unsigned,3> path_index = index;
+  int path_lvl = lvl;
+  std::atomic<SubvoxelPool::Link>* link = findSubvoxelLink(path_index, path_lvl, lvl);
+  if (link == nullptr || link->load(std::memory_order_relaxed) != 0){
+    throw std::logic_error("subvoxels are only allocated once, for a voxel whose parent has been split");
+  }
+  link->store(_subvoxels->allocate(init), std::memory_order_release);
+}
+
+unsigned long Space::getNumSubvoxelBlocks(){
+  return _subvoxels? _subvoxels->getNumBlocks() : 0;
 }
 
 Voxel& Space::getTopVxl(const unsigned int i){
@@ -674,8 +1125,13 @@ const std::array<unsigned long,3> Space::getGridsteps(){
   return getGridstepsOnLvl(_max_depth);
 }
 
+// the lower levels of a sparse octree are not stored in _grid, so the number of voxels is derived from the top level
 const std::array<unsigned long,3> Space::getGridstepsOnLvl(const int lvl) const {
-  return _grid[lvl].getNumElements();
+  std::array<unsigned long,3> gridsteps = _grid[_max_depth].getNumElements();
+  for (char i = 0; i < 3; i++){
+    gridsteps[i] <<= (_max_depth-lvl);
+  }
+  return gridsteps;
 }
 
 std::array<std::array<unsigned int,3>,2> Space::getUnitCellIndexes(){
@@ -766,18 +1222,19 @@ void Space::printGrid(){
     for(unsigned int y = y_min; y < y_max; y++){
       for(unsigned int x = x_min; x < x_max; x++){
         char to_print;
+        const Voxel& vxl = getResolvedVxl(std::array<unsigned int,3>{x,y,z}, _max_depth-depth);
         if (disp_id){
-          to_print = ('0' + getVxlFromGrid(x,y,z, _max_depth-depth).getID());
+          to_print = ('0' + getCavityID({x,y,z}, _max_depth-depth));
         }
         else{
-          to_print = (getVxlFromGrid(x,y,z,_max_depth-depth).getType() == 0b00000011)? 'A' : 'O';
-          if (!readBit(getVxlFromGrid(x,y,z,_max_depth-depth).getType(),0)){to_print = '?';}
-          if (readBit(getVxlFromGrid(x,y,z,_max_depth-depth).getType(),7)){to_print = 'M';}
-          if (getVxlFromGrid(x,y,z,_max_depth-depth).getType() == 0b00000101){to_print = 'X';}
-          if (getVxlFromGrid(x,y,z,_max_depth-depth).getType() == 0b00001001){to_print = 'P';}
-          if (getVxlFromGrid(x,y,z,_max_depth-depth).getType() == 0b00010001){to_print = 'S';}
-          if (getVxlFromGrid(x,y,z,_max_depth-depth).getType() == 0b00100001){to_print = 'p';}
-          if (getVxlFromGrid(x,y,z,_max_depth-depth).getType() == 0b01000001){to_print = 's';}
+          to_print = (vxl.getType() == 0b00000011)? 'A' : 'O';
+          if (!readBit(vxl.getType(),0)){to_print = '?';}
+          if (readBit(vxl.getType(),7)){to_print = 'M';}
+          if (vxl.getType() == 0b00000101){to_print = 'X';}
+          if (vxl.getType() == 0b00001001){to_print = 'P';}
+          if (vxl.getType() == 0b00010001){to_print = 'S';}
+          if (vxl.getType() == 0b00100001){to_print = 'p';}
+          if (vxl.getType() == 0b01000001){to_print = 's';}
         }
 
         std::cout << to_print << " ";
@@ -796,17 +1253,20 @@ void Space::printGrid(){
 // SURFACE LOOK UP TABLE //
 ///////////////////////////
 
-const constexpr std::array<unsigned char,256> SurfaceLUT::types_by_config = {1,2,2,3,2,3,4,6,2,4,3,6,3,6,6,9,2,3,4,6,4,6,8,10,5,7,7,13,7,13,11,6,2,4,3,6,5,7,7,13,4,8,6,10,7,11,13,6,3,6,6,9,7,13,11,6,7,11,13,6,12,7,7,3,2,4,5,7,3,6,7,13,4,8,7,11,6,10,13,6,3,6,7,13,6,9,11,6,7,11,12,7,13,6,7,3,4,8,7,11,7,11,12,7,8,14,11,8,11,8,7,4,6,10,13,6,13,6,7,3,11,8,7,4,7,4,5,2,2,5,4,7,4,7,8,11,3,7,6,13,6,13,10,6,4,7,8,11,8,11,14,8,7,12,11,7,11,7,8,4,3,7,6,13,7,12,11,7,6,11,9,6,13,7,6,3,6,13,10,6,11,7,8,4,13,7,6,3,7,5,4,2,3,7,7,12,6,13,11,7,6,11,13,7,9,6,6,3,6,13,11,7,10,6,8,4,13,7,7,5,6,3,4,2,6,11,13,7,13,7,7,5,10,8,6,4,6,4,3,2,9,6,6,3,6,3,4,2,6,4,3,2,3,2,2,1};
-// Theoretical values from https://doi.org/10.1007/978-3-540-39966-7_33
-// const constexpr std::array<double, 15> SurfaceLUT::area_by_type = {0,0,0.2118,0.669,0.4236,0.4236,0.9779,0.8808,0.6354,0.927,1.2706,1.1897,1.338,1.5731,0.8472};
-// Semi-empirical values from https://doi.org/10.1016/j.imavis.2004.06.012
-const constexpr std::array<double, 15> SurfaceLUT::area_by_type = {0,0,0.636,0.669,1.272,1.272,0.5537,1.305,1.908,0.927,0.4222,1.1897,1.338,1.5731,2.544};
-unsigned char SurfaceLUT::configToType(unsigned char config) {
-  return types_by_config[config];
-}
-double SurfaceLUT::typeToArea(unsigned char type) {
-  return area_by_type[type];
-}
-double SurfaceLUT::configToArea(unsigned char config) {
-  return area_by_type[types_by_config[config]];
+// area of each configuration of a marching cube, combined from the type of each configuration and the area of
+// each type at compile time, so that the area of a configuration takes a single lookup
+const constexpr std::array<uint32_t,256> SurfaceLUT::units_by_config = [](){
+  constexpr std::array<unsigned char,256> types_by_config = {1,2,2,3,2,3,4,6,2,4,3,6,3,6,6,9,2,3,4,6,4,6,8,10,5,7,7,13,7,13,11,6,2,4,3,6,5,7,7,13,4,8,6,10,7,11,13,6,3,6,6,9,7,13,11,6,7,11,13,6,12,7,7,3,2,4,5,7,3,6,7,13,4,8,7,11,6,10,13,6,3,6,7,13,6,9,11,6,7,11,12,7,13,6,7,3,4,8,7,11,7,11,12,7,8,14,11,8,11,8,7,4,6,10,13,6,13,6,7,3,11,8,7,4,7,4,5,2,2,5,4,7,4,7,8,11,3,7,6,13,6,13,10,6,4,7,8,11,8,11,14,8,7,12,11,7,11,7,8,4,3,7,6,13,7,12,11,7,6,11,9,6,13,7,6,3,6,13,10,6,11,7,8,4,13,7,6,3,7,5,4,2,3,7,7,12,6,13,11,7,6,11,13,7,9,6,6,3,6,13,11,7,10,6,8,4,13,7,7,5,6,3,4,2,6,11,13,7,13,7,7,5,10,8,6,4,6,4,3,2,9,6,6,3,6,3,4,2,6,4,3,2,3,2,2,1};
+  // Theoretical values from https://doi.org/10.1007/978-3-540-39966-7_33
+  // constexpr std::array<double, 15> area_by_type = {0,0,0.2118,0.669,0.4236,0.4236,0.9779,0.8808,0.6354,0.927,1.2706,1.1897,1.338,1.5731,0.8472};
+  // Semi-empirical values from https://doi.org/10.1016/j.imavis.2004.06.012
+  constexpr std::array<double, 15> area_by_type = {0,0,0.636,0.669,1.272,1.272,0.5537,1.305,1.908,0.927,0.4222,1.1897,1.338,1.5731,2.544};
+  std::array<uint32_t,256> units = {};
+  for (unsigned config = 0; config < 256; ++config){
+    units[config] = uint32_t(area_by_type[types_by_config[config]] * s_units_per_area + 0.5);
+  }
+  return units;
+}();
+uint32_t SurfaceLUT::configToUnits(unsigned char config) {
+  return units_by_config[config];
 }
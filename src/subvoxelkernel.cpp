@@ -0,0 +1,112 @@
+#include "subvoxelkernel.h"
+#if defined(__AVX512F__) || defined(__AVX__)
+#include <immintrin.h>
+#endif
+
+// squared limits of one atom in the order inside, partial, shell, touching core, collect. a voxel has a
+// relation, if its squared distance to the atom is below the limit. negative limits are never met
+static const char s_n_limits = 5;
+typedef std::array<double,s_n_limits> Limits;
+typedef std::array<unsigned char,s_n_limits> Masks;
+
+// sets bit i of masks[r], if the squared distance between subvoxel i and the atom is below limits[r].
+// the distance is computed in the same order as in Vector::squared, so that the results match Voxel::isAtom.
+// this only holds without contraction into fused multiply-adds, which gcc does by default for AVX-512 and
+// -march=native, also for the intrinsics. hence, build with -ffp-contract=off (make SIMD=avx|avx512)
+static inline void compareDistances(const double* sub_x, const double* sub_y, const double* sub_z,
+                                    const double atom_x, const double atom_y, const double atom_z,
+                                    const Limits& limits, Masks& masks){
+#if defined(__AVX512F__)
+  const __m512d dx = _mm512_sub_pd(_mm512_load_pd(sub_x), _mm512_set1_pd(atom_x));
+  const __m512d dy = _mm512_sub_pd(_mm512_load_pd(sub_y), _mm512_set1_pd(atom_y));
+  const __m512d dz = _mm512_sub_pd(_mm512_load_pd(sub_z), _mm512_set1_pd(atom_z));
+  const __m512d dist = _mm512_add_pd(_mm512_add_pd(_mm512_mul_pd(dx,dx), _mm512_mul_pd(dy,dy)), _mm512_mul_pd(dz,dz));
+  for (char r = 0; r < s_n_limits; ++r){
+    masks[r] = _mm512_cmp_pd_mask(dist, _mm512_set1_pd(limits[r]), _CMP_LT_OQ);
+  }
+#elif defined(__AVX__)
+  masks.fill(0);
+  for (char half = 0; half < 2; ++half){
+    const __m256d dx = _mm256_sub_pd(_mm256_load_pd(sub_x + 4*half), _mm256_set1_pd(atom_x));
+    const __m256d dy = _mm256_sub_pd(_mm256_load_pd(sub_y + 4*half), _mm256_set1_pd(atom_y));
+    const __m256d dz = _mm256_sub_pd(_mm256_load_pd(sub_z + 4*half), _mm256_set1_pd(atom_z));
+    const __m256d dist = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(dx,dx), _mm256_mul_pd(dy,dy)), _mm256_mul_pd(dz,dz));
+    for (char r = 0; r < s_n_limits; ++r){
+      masks[r] |= _mm256_movemask_pd(_mm256_cmp_pd(dist, _mm256_set1_pd(limits[r]), _CMP_LT_OQ)) << (4*half);
+    }
+  }
+#else
+  masks.fill(0);
+  for (int i = 0; i < 8; ++i){
+    const double dx = sub_x[i] - atom_x;
+    const double dy = sub_y[i] - atom_y;
+    const double dz = sub_z[i] - atom_z;
+    const double dist = dx*dx + dy*dy + dz*dz;
+    for (char r = 0; r < s_n_limits; ++r){
+      masks[r] |= (dist < limits[r]) << i;
+    }
+  }
+#endif
+}
+
+void classifySubvoxels(const CandidateAtoms& candidates, const std::array<Vector,8>& pos_sub, const double rad_sub,
+                       const double rad_probe, const double range, const unsigned char active, const bool collect,
+                       std::array<AtomRelations,8>& sub){
+  for (char i = 0; i < 8; ++i){
+    sub[i].relations = mvREL_NONE;
+    sub[i].candidates.clear();
+  }
+  if (active == 0){return;}
+  alignas(64) std::array<double,8> sub_x;
+  alignas(64) std::array<double,8> sub_y;
+  alignas(64) std::array<double,8> sub_z;
+  for (char i = 0; i < 8; ++i){
+    sub_x[i] = pos_sub[i][0];
+    sub_y[i] = pos_sub[i][1];
+    sub_z[i] = pos_sub[i][2];
+    // the lists can't get longer than the list of the voxel. reserving avoids growing them atom by atom
+    if (collect && ((active >> i) & 1)){sub[i].candidates.reserve(candidates.size());}
+  }
+  // bit i: subvoxel i has the relation to any of the atoms evaluated so far
+  unsigned char inside = 0;
+  unsigned char partial = 0;
+  unsigned char shell = 0;
+  unsigned char touching = 0;
+  Limits limits;
+  Masks masks;
+  for (int a = 0; a < candidates.size(); ++a){
+    const double rad_atom = candidates.rad[a];
+    const double lim_inside = rad_atom - rad_sub;
+    const double lim_partial = rad_atom + rad_sub;
+    const double lim_shell = rad_atom + rad_probe - rad_sub;
+    const double lim_touching = rad_atom + rad_probe + rad_sub;
+    const double lim_collect = range + rad_atom;
+    limits = {
+      (0 < lim_inside)? lim_inside*lim_inside : -1,
+      lim_partial*lim_partial,
+      (0 < lim_shell)? lim_shell*lim_shell : -1,
+      lim_touching*lim_touching,
+      collect? lim_collect*lim_collect : -1};
+    compareDistances(sub_x.data(), sub_y.data(), sub_z.data(), candidates.x[a], candidates.y[a], candidates.z[a], limits, masks);
+    inside |= masks[0];
+    partial |= masks[1];
+    shell |= masks[2];
+    touching |= masks[3];
+    const unsigned char add = masks[4] & active;
+    if (add != 0){
+      for (char i = 0; i < 8; ++i){
+        if ((add >> i) & 1){sub[i].candidates.add(candidates.getPos(a), rad_atom);}
+      }
+    }
+    // subvoxels inside an atom are never split, so they don't need the remaining candidates
+    if ((inside & active) == active){break;}
+  }
+  for (char i = 0; i < 8; ++i){
+    char relations = mvREL_NONE;
+    if ((inside >> i) & 1){relations |= mvREL_INSIDE;}
+    if ((partial >> i) & 1){relations |= mvREL_PARTIAL;}
+    if ((shell >> i) & 1){relations |= mvREL_SHELL;}
+    if ((touching >> i) & 1){relations |= mvREL_TOUCHING_CORE;}
+    sub[i].relations = relations;
+  }
+}
@@ -0,0 +1,46 @@
+#include "subvoxelpool.h"
+#include <limits>
+#include <new> // bad_alloc
+
+/////////////////
+// CONSTRUCTOR //
+/////////////////
+
+SubvoxelPool::SubvoxelPool(const std::array<unsigned long,3>& n_top_vxl)
+  : _n_top_vxl(n_top_vxl),
+    _top_links(n_top_vxl[0]*n_top_vxl[1]*n_top_vxl[2]),
+    _chunks((std::numeric_limits<Link>::max() >> s_chunk_bits) + 1) {}
+
+////////////
+// ACCESS //
+////////////
+
+// row-major order, independent of the layout of the grids
+std::atomic<SubvoxelPool::Link>& SubvoxelPool::getTopLink(const std::array<unsigned,3>& index){
+  return _top_links[(index[2] * _n_top_vxl[1] + index[1]) * _n_top_vxl[0] + index[0]];
+}
+
+unsigned long SubvoxelPool::getNumBlocks(){
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _n_blocks-1;
+}
+
+////////////////
+// ALLOCATION //
+////////////////
+
+// returns the link to a new block of 8 copies of init. the block only becomes visible to other threads, once the
+// caller stores the link in the parent
+SubvoxelPool::Link SubvoxelPool::allocate(const Voxel& init){
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (_n_blocks > std::numeric_limits<Link>::max()){throw std::bad_alloc();}
+  const Link link = _n_blocks++;
+  std::unique_ptr<Block[]>& chunk = _chunks[link >> s_chunk_bits];
+  if (!chunk){chunk = std::make_unique<Block[]>(size_t(1) << s_chunk_bits);}
+  Block& block = getBlock(link);
+  for (char i = 0; i < 8; ++i){
+    block.vxl[i] = init;
+    block.sub[i].store(0, std::memory_order_relaxed);
+  }
+  return link;
+}
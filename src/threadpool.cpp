@@ -0,0 +1,193 @@
+#include "threadpool.h"
+
+thread_local ThreadPool* ThreadPool::tl_pool = nullptr;
+thread_local unsigned ThreadPool::tl_worker = 0;
+
+/////////////////
+// CONSTRUCTOR //
+/////////////////
+
+ThreadPool::ThreadPool(const unsigned n_threads){
+  const unsigned n_workers = evalNumThreads(n_threads);
+  for (unsigned i = 0; i < n_workers; ++i){
+    _deques.push_back(std::make_unique<TaskDeque>());
+  }
+  // workers are only started once all deques exist, because any worker may steal from any deque
+  for (unsigned i = 0; i < n_workers; ++i){
+    _workers.emplace_back(&ThreadPool::work, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool(){
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _stop = true;
+  }
+  _task_available.notify_all();
+  for (std::thread& worker : _workers){
+    worker.join();
+  }
+}
+
+////////////
+// ACCESS //
+////////////
+
+unsigned ThreadPool::getNumThreads() const {
+  return _workers.size();
+}
+
+unsigned long ThreadPool::getNumCompleted(){
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _n_completed;
+}
+
+// index of the worker that runs the calling task, so that tasks can add to accumulators owned by their thread.
+// 0 outside of any pool
+unsigned ThreadPool::getWorkerIndex(){
+  return tl_pool != nullptr ? tl_worker : 0;
+}
+
+// a value of 0 selects as many threads as the hardware supports
+unsigned ThreadPool::evalNumThreads(const unsigned n_threads){
+  if (n_threads != 0){return n_threads;}
+  const unsigned n_hardware = std::thread::hardware_concurrency();
+  return n_hardware != 0 ? n_hardware : 1;
+}
+
+///////////
+// TASKS //
+///////////
+
+void ThreadPool::submit(std::function<void()> task){
+  {
+    std::lock_guard<std::mutex> lock(_mutex);
+    _tasks.push(std::move(task));
+    _n_unfinished++;
+  }
+  _task_available.notify_one();
+}
+
+// blocks until either all submitted tasks are done or the timeout is reached. returns true if all
+// tasks are done. a short timeout allows the caller to update the progress bar in between. if a task
+// has thrown, the exception is rethrown here once all tasks are done, so that no task is left running
+// with references to the caller's data
+bool ThreadPool::waitForTasks(const std::chrono::milliseconds timeout){
+  std::unique_lock<std::mutex> lock(_mutex);
+  if (!_task_done.wait_for(lock, timeout, [this]{return _n_unfinished == 0;})){return false;}
+  if (_error){
+    std::exception_ptr error = _error;
+    _error = nullptr;
+    std::rethrow_exception(error);
+  }
+  return true;
+}
+
+// calls func(i) for all i in [0,n) and returns once all calls are done. inside a worker thread, all
+// calls but the first are pushed to the worker's deque, where they can be stolen by other workers.
+// while waiting, the worker helps by executing other subtasks. outside of a pool, or if the pool
+// only has one thread, the calls are simply executed in order. the subtasks reference the stack of
+// the calling thread, so an exception is only rethrown after all of them are done
+void ThreadPool::forkJoin(const unsigned n, const std::function<void(const unsigned)>& func){
+  ThreadPool* pool = tl_pool;
+  if (pool == nullptr || pool->getNumThreads() < 2 || n < 2){
+    for (unsigned i = 0; i < n; ++i){
+      func(i);
+    }
+    return;
+  }
+  const unsigned worker = tl_worker;
+  std::atomic<unsigned> n_remaining(n-1);
+  std::exception_ptr error;
+  std::mutex error_mutex;
+  auto call = [&func, &error, &error_mutex](const unsigned i){
+    try {func(i);}
+    catch (...){
+      std::lock_guard<std::mutex> lock(error_mutex);
+      if (!error){error = std::current_exception();}
+    }
+  };
+  {
+    TaskDeque& own = *pool->_deques[worker];
+    std::lock_guard<std::mutex> lock(own.mutex);
+    for (unsigned i = n-1; i > 0; --i){
+      // decrementing the counter must be the last access to the stack of the waiting thread
+      own.tasks.push_back([&call, &n_remaining, i](){
+        call(i);
+        n_remaining.fetch_sub(1);
+      });
+    }
+  }
+  pool->_n_stealable += n-1;
+  pool->_task_available.notify_all();
+
+  call(0);
+  while (n_remaining.load() > 0){
+    if (!pool->runSpawnedTask(worker)){
+      std::this_thread::yield();
+    }
+  }
+  if (error){std::rethrow_exception(error);}
+}
+
+// executes one spawned subtask. the worker's own deque is checked first, then the deques of all
+// other workers. returns false if there was nothing to do
+bool ThreadPool::runSpawnedTask(const unsigned worker){
+  if (_n_stealable.load() == 0){return false;}
+  std::function<void()> task;
+  for (size_t i = 0; i < _deques.size() && !task; ++i){
+    TaskDeque& deque = *_deques[(worker+i)%_deques.size()];
+    std::lock_guard<std::mutex> lock(deque.mutex);
+    if (deque.tasks.empty()){continue;}
+    if (i == 0){ // own deque: newest subtask first, its data is most likely still in cache
+      task = std::move(deque.tasks.back());
+      deque.tasks.pop_back();
+    }
+    else { // steal: oldest subtask first, it is closest to the root of the recursion
+      task = std::move(deque.tasks.front());
+      deque.tasks.pop_front();
+    }
+    _n_stealable--;
+  }
+  if (!task){return false;}
+  task();
+  return true;
+}
+
+// loop executed by every worker thread
+void ThreadPool::work(const unsigned worker){
+  tl_pool = this;
+  tl_worker = worker;
+  while (true){
+    if (runSpawnedTask(worker)){continue;}
+    std::function<void()> task;
+    bool failed;
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      // spawned subtasks do not notify under the lock, therefore the wait needs a timeout
+      _task_available.wait_for(lock, std::chrono::milliseconds(1),
+          [this]{return _stop || !_tasks.empty() || _n_stealable.load() > 0;});
+      if (_tasks.empty()){
+        if (_stop){return;}
+        continue;
+      }
+      task = std::move(_tasks.front());
+      _tasks.pop();
+      failed = bool(_error);
+    }
+    // after a task has thrown, the remaining tasks are only counted as done
+    if (!failed){
+      try {task();}
+      catch (...){
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (!_error){_error = std::current_exception();}
+      }
+    }
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      _n_unfinished--;
+      _n_completed++;
+    }
+    _task_done.notify_all();
+  }
+}
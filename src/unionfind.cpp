@@ -0,0 +1,43 @@
+#include "unionfind.h"
+#include <utility> // swap
+
+/////////////////
+// CONSTRUCTOR //
+/////////////////
+
+UnionFind::UnionFind(const Element n) : _parent(n) {
+  for (Element i = 0; i < n; ++i){
+    _parent[i].store(i, std::memory_order_relaxed);
+  }
+}
+
+///////////////////
+// SET FUNCTIONS //
+///////////////////
+
+// returns the root of the set. every visited element is linked to its grandparent on the way (path halving).
+// a parent is never larger than its child, so links only ever move closer to the root
+UnionFind::Element UnionFind::find(Element x){
+  while (true){
+    Element parent = _parent[x].load(std::memory_order_relaxed);
+    if (parent == x){return x;}
+    const Element grandparent = _parent[parent].load(std::memory_order_relaxed);
+    if (grandparent != parent){
+      _parent[x].compare_exchange_weak(parent, grandparent, std::memory_order_relaxed);
+    }
+    x = grandparent;
+  }
+}
+
+// links the larger root to the smaller one. if another thread changed the larger root in the meantime, the
+// roots are looked up again
+void UnionFind::unite(Element a, Element b){
+  while (true){
+    a = find(a);
+    b = find(b);
+    if (a == b){return;}
+    if (a < b){std::swap(a,b);}
+    Element expected = a;
+    if (_parent[a].compare_exchange_strong(expected, b, std::memory_order_relaxed)){return;}
+  }
+}
@@ -0,0 +1,57 @@
+#include "volumetally.h"
+#include <limits>
+
+// only the IDs that are found are reserved. until a voxel with an ID is added, its bounds are empty
+void VolumeTally::reserveID(const CavityID id){
+  if (id < _core.size()){return;}
+  _core.resize(id+1, 0);
+  _shell.resize(id+1, 0);
+  _core_found.resize(id+1, false);
+  _min.resize(id+1, {std::numeric_limits<unsigned>::max(), std::numeric_limits<unsigned>::max(), std::numeric_limits<unsigned>::max()});
+  _max.resize(id+1, {0,0,0});
+}
+
+// adds a number of bottom level voxels of the same type and ID, which lie within the bounds [min,max]
+void VolumeTally::addVoxels(const char type, const CavityID id, const double n, const std::array<unsigned,3>& min, const std::array<unsigned,3>& max){
+  _type[(unsigned char)type] += n;
+  _type_found[(unsigned char)type] = true;
+  reserveID(id);
+  if (type == 0b00001001){
+    _core[id] += n;
+    _core_found[id] = true;
+  }
+  else if (type == 0b00010001){
+    _shell[id] += n;
+  }
+  for (char i = 0; i < 3; ++i){
+    _min[id][i] = std::min(_min[id][i], min[i]);
+    _max[id][i] = std::max(_max[id][i], max[i]);
+  }
+}
+
+// the counts of the other tally are multiplied by the weight. the bounds and the types and cavities found are
+// merged regardless of the weight
+void VolumeTally::merge(const VolumeTally& other, const double weight){
+  for (unsigned type = 0; type < 256; ++type){
+    _type[type] += other._type[type] * weight;
+    _type_found[type] = _type_found[type] || other._type_found[type];
+  }
+  if (other._core.empty()){return;}
+  reserveID(other._core.size()-1);
+  for (CavityID id = 0; id < other._core.size(); ++id){
+    _core[id] += other._core[id] * weight;
+    _shell[id] += other._shell[id] * weight;
+    _core_found[id] = _core_found[id] || other._core_found[id];
+    for (char i = 0; i < 3; ++i){
+      _min[id][i] = std::min(_min[id][i], other._min[id][i]);
+      _max[id][i] = std::max(_max[id][i], other._max[id][i]);
+    }
+  }
+}
+
+// converts from units of bottom level voxels to units of volume
+void VolumeTally::getVolumes(std::map<char,double>& volumes, const double unit_volume) const {
+  for (unsigned type = 0; type < 256; ++type){
+    if (_type_found[type]){volumes[char(type)] = _type[type] * unit_volume;}
+  }
+}
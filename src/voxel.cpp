@@ -2,7 +2,8 @@
 #include "space.h"
 #include "misc.h"
 #include "atom.h"
-#include "controller.h"
+#include "pooledbuffer.h"
+#include "threadpool.h"
 #include <cmath> // abs, pow
 #include <algorithm> // max_element, swap
 #include <cassert>
@@ -12,9 +13,6 @@
 // AUX FUNCTIONS //
 ///////////////////
 
-inline double Voxel::calcVxlRadius(const double& max_depth){
-  return max_depth != 0 ? 0.86602540378 * s_cell->getVxlSize() * (pow(2,max_depth) - 1) : 0;
-}
 char mergeTypes(std::vector<Voxel*>&);
 char mergeTypes(const std::array<char,8>&);
 
@@ -138,90 +136,91 @@ void signCombinations(std::vector<std::array<int,3>>& list, std::array<unsigned
 // CONSTRUCTOR //
 /////////////////
 
-Voxel::Voxel(){
-  _type = 0;
-  _identity = 0;
-}
+Voxel::Voxel() : _type(0) {}
 
 ////////////
 // ACCESS //
 ////////////
 
-// subvoxels (through s_cell)
-Voxel& Voxel::getSubvoxel(std::array<unsigned,3> p_index, const unsigned p_lvl, const std::array<char,3>& sub_index){
+// subvoxels (through cell)
+Voxel& Voxel::getSubvoxel(Space& cell, std::array<unsigned,3> p_index, const unsigned p_lvl, const std::array<char,3>& sub_index){
   for (char i = 0; i < 3; ++i){
     p_index[i] *= 2;
     p_index[i] += sub_index[i];
   }
-  return s_cell->getVxlFromGrid(p_index,p_lvl-1);
+  return cell.getVxlFromGrid(p_index,p_lvl-1);
 }
 
-Voxel& Voxel::getSubvoxel(std::array<unsigned,3> p_index, const unsigned p_lvl, const char j){
+Voxel& Voxel::getSubvoxel(Space& cell, std::array<unsigned,3> p_index, const unsigned p_lvl, const char j){
   for (char i = 0; i < 3; ++i){
     p_index[i] *= 2;
     p_index[i] += (j/pow2(i))%2;
   }
-  return s_cell->getVxlFromGrid(p_index,p_lvl-1);
+  return cell.getVxlFromGrid(p_index,p_lvl-1);
 }
 
-Voxel& Voxel::getSubvoxel(std::array<unsigned,3> sub_index, const unsigned p_lvl){
-  return s_cell->getVxlFromGrid(sub_index,p_lvl-1);
+Voxel& Voxel::getSubvoxel(Space& cell, std::array<unsigned,3> sub_index, const unsigned p_lvl){
+  return cell.getVxlFromGrid(sub_index,p_lvl-1);
 }
 
-bool Voxel::hasSubvoxel(){return readBit(_type,7);}
-bool Voxel::isCore(){return readBit(_type,3);}
-bool Voxel::isAssigned(){return readBit(_type,0);}
-
-// type
-char Voxel::getType() const {return _type;}
-void Voxel::setType(char input){_type = input;}
+//////////////////
+// CALC CONTEXT //
+//////////////////
 
-// ID
-void Voxel::setID(unsigned char id){_identity = id;}
-unsigned char Voxel::getID() const {return _identity;}
+// the context has to be created before beginning the type assignment routine. it builds the spatial index
+// of the atoms, for which the largest probe radius of the calculation is needed
+CalcContext::CalcContext(Space& cell, const std::vector<Atom>& atoms, const AtomIndex::Engine engine, const double r_probe_max, CalcMonitor& monitor)
+  : cell(cell), atom_index(atoms, engine, r_probe_max), monitor(monitor), abort_flag(monitor.getAbortSignal()) {}
 
-/////////////////////////////////
-// TYPE ASSIGNMENT PREPARATION //
-/////////////////////////////////
-
-// function to call before beginning the type assignment routine in order to prepare static variables
-void Voxel::prepareTypeAssignment(Space* cell, std::vector<Atom>& atoms){
-  s_cell = cell;
-  delete s_atomtree;
-  s_atomtree = new AtomTree(atoms);
-}
-
-void Voxel::storeProbe(const double r_probe, const bool masking_mode){
-  s_r_probe = r_probe;
-  s_masking_mode = masking_mode;
-  s_search_indices = SearchIndex(r_probe, s_cell->getVxlSize(), s_cell->getMaxDepth());
+void CalcContext::storeProbe(const double r_probe_inp, const bool masking_mode_inp){
+  r_probe = r_probe_inp;
+  masking_mode = masking_mode_inp;
+  search_indices = SearchIndex(r_probe, cell.getVxlSize(), cell.getMaxDepth());
 }
 ///////////////////////////////
 // TYPE ASSIGNMENT 1ST ROUND //
 ///////////////////////////////
+
 // part of the type assigment routine. first evaluation is only concerned with the relation between
-// voxels and atoms
-char Voxel::evalRelationToAtoms(const std::array<unsigned,3>& index_vxl, Vector pos_vxl, const int lvl){
-  if(Ctrl::getInstance()->getAbortFlag()){return 0;}
-  if (isAssigned()) {return _type;}
+// voxels and atoms. subvoxels are evaluated together with their siblings by the parent, which passes the
+// relations and the candidates for the subvoxel's own subvoxels. top level voxels search the atom index
+char Voxel::evalRelationToAtoms(const CalcContext& ctx, const std::array<unsigned,3>& index_vxl, Vector pos_vxl, const int lvl, AtomRelations* relations){
+  if(ctx.isAborted()){return 0;}
+  if (isAssigned()) {return getType();}
+  double rad_vxl = calcVxlRadius(ctx.cell.getVxlSize(), lvl); // calculated every time, since max_depth may change (not expensive)
+  // bottom level voxels cannot be split and don't need to collect candidates for their subvoxels
+  PooledBuffer<CandidateAtoms> top_candidates(lvl > 0 && relations == NULL);
+  CandidateAtoms* collect = top_candidates.get();
+  if (collect != NULL){collect->clear();}
   if (!hasSubvoxel()) {
-    double rad_vxl = calcVxlRadius(lvl); // calculated every time, since max_depth may change (not expensive)
-    traverseTree(s_atomtree->getRoot(), s_atomtree->getMaxRad(), pos_vxl, rad_vxl, s_r_probe, lvl);
-    if (_type == 0){_type = s_masking_mode? 0b00100001 : 0b00001001;}
+    const char prev_type = getType();
+    if (relations != NULL){applyAtomRelations(ctx, relations->relations);}
+    else {traverseTree(ctx, pos_vxl, rad_vxl, ctx.r_probe, collect);}
+    if (getType() == 0){setType(ctx.masking_mode? 0b00100001 : 0b00001001);}
+    if (hasSubvoxel()) {materializeSubvoxels(ctx.cell, index_vxl, lvl, prev_type);}
+  }
+  else if (collect != NULL) {
+    // the voxel was split during the masking mode. only the candidates are collected
+    const double range = rad_vxl + ctx.r_probe + s_candidate_margin;
+    ctx.atom_index.forEachAtomInRange(pos_vxl, range, [&](const Vector& pos_atom, const double rad_atom){
+      if ((pos_vxl-pos_atom) < range + rad_atom){collect->add(pos_atom, rad_atom);}
+      return false;
+    });
   }
   if (hasSubvoxel()) {
-    splitVoxel(index_vxl, pos_vxl, lvl);
+    splitVoxel(ctx, index_vxl, pos_vxl, lvl, (relations != NULL)? relations->candidates : *collect);
   }
   else {
     // voxel has been processed
-    passTypeToChildren(index_vxl, lvl);
+    passTypeToChildren(ctx.cell, index_vxl, lvl);
   }
-  return _type;
+  return getType();
 }
 
-// passes parent type to all children
-void Voxel::passTypeToChildren(const std::array<unsigned,3>& index, const int lvl){
-  if (lvl == 0){return;}
+// passes parent type to all children. with lazy type inheritance, the subvoxels of pure voxels are not
+// written to. instead, their type is looked up from the closest pure ancestor (Space::resolveVxl)
+void Voxel::passTypeToChildren(Space& cell, const std::array<unsigned,3>& index, const int lvl){
+  if (lvl == 0 || cell.hasLazyInheritance()){return;}
   std::array<unsigned,3> sub_index;
   for (char x = 0; x < 2; ++x){
     sub_index[0] = index[0]*2 + x;
@@ -230,15 +229,24 @@ void Voxel::passTypeToChildren(const std::array<unsigned,3>& index, const int lv
       for (char z = 0; z < 2; ++z){
         sub_index[2] = index[2]*2 + z;
 
-        getSubvoxel(sub_index, lvl).setType(_type);
-        getSubvoxel(sub_index, lvl).passTypeToChildren(sub_index, lvl-1);
+        getSubvoxel(cell, sub_index, lvl).setType(getType());
+        getSubvoxel(cell, sub_index, lvl).passTypeToChildren(cell, sub_index, lvl-1);
       }
     }
   }
 }
 
-void Voxel::passIDtoChildren(const std::array<unsigned,3>& index, const int lvl){
-  if (lvl == 0){return;}
+// with lazy type inheritance, the subvoxels of a pure voxel only receive the voxel's type when the
+// voxel is split. splitting is final, so this happens at most once per voxel. in a sparse octree, this is
+// when the subvoxels are allocated
+void Voxel::materializeSubvoxels(Space& cell, const std::array<unsigned,3>& index, const int lvl, const char prev_type){
+  if (lvl == 0 || !cell.hasLazyInheritance()){return;}
+  if (cell.isSparse()){
+    Voxel init;
+    init.setType(prev_type);
+    cell.allocateSubvoxels(index, lvl, init);
+    return;
+  }
   std::array<unsigned,3> sub_index;
   for (char x = 0; x < 2; ++x){
     sub_index[0] = index[0]*2 + x;
@@ -247,124 +255,114 @@ void Voxel::passIDtoChildren(const std::array<unsigned,3>& index, const int lvl)
       for (char z = 0; z < 2; ++z){
         sub_index[2] = index[2]*2 + z;
 
-        getSubvoxel(sub_index, lvl).setID(_identity);
-        getSubvoxel(sub_index, lvl).passIDtoChildren(sub_index, lvl-1);
+        getSubvoxel(cell, sub_index, lvl).setType(prev_type);
       }
     }
   }
 }
 
 // adds an array of size 8 to the voxel that contains 8 subvoxels and evaluates each subvoxel's type
-void Voxel::splitVoxel(const std::array<unsigned,3>& vxl_index, const Vector& vxl_pos, const double lvl){
+void Voxel::splitVoxel(const CalcContext& ctx, const std::array<unsigned,3>& vxl_index, const Vector& vxl_pos, const double lvl, const CandidateAtoms& candidates){
   // split into 8 subvoxels
-  std::array<char,8> subtypes;
-  std::array<unsigned,3> sub_index;
-  Vector factors;
-  char i = 0;
-  for (char z = 0; z < 2; ++z){
-    sub_index[2] = vxl_index[2]*2 + z;
-    factors[2] = z ? 1 : -1;
-    for (char y = 0; y < 2; ++y){
-      sub_index[1] = vxl_index[1]*2 + y;
-      factors[1] = y ? 1 : -1;
-      for (char x = 0; x < 2; ++x){
-        sub_index[0] = vxl_index[0]*2 + x;
-        factors[0] = x ? 1 : -1;
-        // modify position
-        Vector new_pos = vxl_pos + factors * s_cell->getVxlSize() * std::pow(2,lvl-2);
-
-        subtypes[i] = getSubvoxel(sub_index, lvl).evalRelationToAtoms(sub_index, new_pos, lvl-1);
-        ++i;
-
-      }
+  std::array<std::array<unsigned,3>,8> sub_index;
+  std::array<Vector,8> sub_pos;
+  unsigned char active = 0;
+  for (char i = 0; i < 8; ++i){
+    Vector factors;
+    for (char dim = 0; dim < 3; ++dim){
+      const char j = (i >> dim) & 1;
+      sub_index[i][dim] = vxl_index[dim]*2 + j;
+      factors[dim] = j ? 1 : -1;
     }
+    // modify position
+    sub_pos[i] = vxl_pos + factors * ctx.cell.getVxlSize() * std::pow(2,lvl-2);
+    if (!getSubvoxel(ctx.cell, sub_index[i], lvl).isAssigned()){active |= 1 << i;}
+  }
+  // the subvoxels are evaluated against the candidates all at once. subvoxels on the bottom level cannot be
+  // split and don't need to collect candidates for their subvoxels
+  const double rad_sub = calcVxlRadius(ctx.cell.getVxlSize(), lvl-1);
+  PooledBuffer<std::array<AtomRelations,8>> relations;
+  classifySubvoxels(candidates, sub_pos, rad_sub, ctx.r_probe, rad_sub + ctx.r_probe + s_candidate_margin, active, lvl > 1, *relations);
+
+  std::array<char,8> subtypes;
+  auto evalSubvoxel = [&](const unsigned i){
+    subtypes[i] = getSubvoxel(ctx.cell, sub_index[i], lvl).evalRelationToAtoms(ctx, sub_index[i], sub_pos[i], lvl-1, &(*relations)[i]);
+  };
+  // subvoxels are independent of each other. large subvoxels are spawned as tasks that idle threads may steal
+  if (lvl >= s_min_spawn_lvl){
+    ThreadPool::forkJoin(8, evalSubvoxel);
+  }
+  else {
+    for (unsigned i = 0; i < 8; ++i){evalSubvoxel(i);}
   }
   setType(mergeTypes(subtypes));
 }
 
-// goes through all close atoms to determine a voxel's type
-void Voxel::traverseTree
-  (const AtomNode* node,
-   const double rad_max,
-   const Vector& pos_vxl,
-   const double rad_vxl,
-   const double rad_probe,
-   const int max_depth,
-   const char exit_type,
-   const char dim){
-
-  if (node == NULL){return;}
-  const Atom& atom = node->getAtom();
-
-  // distance between atom and voxel along one dimension
-  double dist1D = distance(atom.getPosVec(), pos_vxl, dim);
-
-  if (abs(dist1D) > (rad_vxl + rad_max + rad_probe)){ // then atom is too far to matter for voxel type
-      traverseTree(dist1D < 0 ? node->getLeftChild() : node->getRightChild(),
-          rad_max, pos_vxl, rad_vxl, rad_probe, max_depth, exit_type, (dim+1)%3);
-  }
-  else{ // then atom is close enough to influence voxel type
-    if(isAtom(atom, pos_vxl, rad_vxl, rad_probe)){return;}
-
-    // continue with both children
-    for (AtomNode* child : {node->getLeftChild(), node->getRightChild()}){
-      traverseTree(child, rad_max, pos_vxl, rad_vxl, rad_probe, max_depth, exit_type, (dim+1)%3);
-    }
-  }
+// estimates the cost of evaluating a voxel by counting all atoms close enough to influence its type
+unsigned Voxel::countNearbyAtoms(const CalcContext& ctx, const Vector& pos_vxl, const int lvl){
+  const double rad_vxl = calcVxlRadius(ctx.cell.getVxlSize(), lvl);
+  unsigned n_atoms = 0;
+  ctx.atom_index.forEachAtomInRange(pos_vxl, rad_vxl + ctx.r_probe, [&](const Vector& pos_atom, const double rad_atom){
+    if ((pos_vxl-pos_atom) < rad_vxl + rad_atom + ctx.r_probe){n_atoms++;}
+    return false;
+  });
+  return n_atoms;
+}
+
+// goes through all close atoms to determine a voxel's type. the resulting type does not depend on the order,
+// in which the atoms are evaluated. once the voxel is found to be inside an atom, no other atom can change its
+// type and the search ends. if collect is given, all atoms within range are added to it for the subvoxels
+void Voxel::traverseTree(const CalcContext& ctx, const Vector& pos_vxl, const double rad_vxl, const double rad_probe, CandidateAtoms* collect){
+  const double range = rad_vxl + rad_probe + s_candidate_margin;
+  ctx.atom_index.forEachAtomInRange(pos_vxl, range, [&](const Vector& pos_atom, const double rad_atom){
+    if (collect != NULL && (pos_vxl-pos_atom) < range + rad_atom){collect->add(pos_atom, rad_atom);}
+    return isAtom(ctx, pos_atom, rad_atom, pos_vxl, rad_vxl, rad_probe);
+  });
 }
 
 // assign a type based on the distance between a voxel and an atom
-bool Voxel::isAtom(const Atom& atom, const Vector& pos_vxl, const double rad_vxl, const double rad_probe){
-  Vector dist = pos_vxl - atom.getPosVec();
+bool Voxel::isAtom(const CalcContext& ctx, const Vector& pos_atom, const double rad_atom, const Vector& pos_vxl, const double rad_vxl, const double rad_probe){
+  Vector dist = pos_vxl - pos_atom;
 
-  if((dist < atom.getRad() - rad_vxl) && (0 < atom.getRad() - rad_vxl)){ // if completely inside atom
-    _type = 0b00000011;
+  if((dist < rad_atom - rad_vxl) && (0 < rad_atom - rad_vxl)){ // if completely inside atom
+    setType(0b00000011);
     return true;
   }
-  else if (dist < atom.getRad() + rad_vxl){ // if partially inside atom
-    if (readBit(_type,1)){return false;} // if inside atom
-    _type = 0b10000010;
+  else if (dist < rad_atom + rad_vxl){ // if partially inside atom
+    if (readBit(getType(),1)){return false;} // if inside atom
+    setType(0b10000010);
   }
-  else if ((dist < atom.getRad() + rad_probe - rad_vxl) && (0 < atom.getRad() + rad_probe - rad_vxl)){ // if outside atom but not touching potential probe core
-    if (readBit(_type,1)){return false;} // if mixed or inside atom
-    _type = s_masking_mode? 0b01000000 : 0b00010000;
+  else if ((dist < rad_atom + rad_probe - rad_vxl) && (0 < rad_atom + rad_probe - rad_vxl)){ // if outside atom but not touching potential probe core
+    if (readBit(getType(),1)){return false;} // if mixed or inside atom
+    setType(ctx.masking_mode? 0b01000000 : 0b00010000);
   }
-  else if (dist < atom.getRad() + rad_probe + rad_vxl){ // if outside atom but touching potential probe core
-    if (readBit(_type,4) || readBit(_type,1)){return false;} // if mixed, inside atom, or potential shell
-    _type = s_masking_mode? 0b11000000 : 0b10010000;
+  else if (dist < rad_atom + rad_probe + rad_vxl){ // if outside atom but touching potential probe core
+    const char type = getType();
+    if (readBit(type,4) || readBit(type,6) || readBit(type,1)){return false;} // if mixed, inside atom, or potential shell (of either probe)
+    setType(ctx.masking_mode? 0b11000000 : 0b10010000);
   }
   return false;
 }
 
-// go through a tree, starting from node. return a list of atoms that are a specified max distance
-// from a point with radius rad_point.
-void Voxel::listFromTree(
-  std::vector<int>& atom_id_list,
-  const AtomNode* node,
-  const Vector& pos_point,
-  const double& rad_point,
-  const double& rad_max, // ideally this value should be retrieved from node
-  const double& max_dist,
-  const char dim)
-{
-  if (node == NULL){return;}
-
-  // distance between atom and point along one dimension
-  double dist1D = distance(node->getAtom().getPosVec(), pos_point, dim);
-  double rad_atom = node->getAtom().getRad();
-
-  if (abs(dist1D) > rad_point + rad_max + max_dist) { // then atom is too far
-      listFromTree(atom_id_list, dist1D<0? node->getLeftChild() : node->getRightChild(), pos_point, rad_point, rad_max, max_dist, (dim+1)%3);
-  }
-  else { // then atom may be close enough
-    if ((pos_point-node->getAtom().getPosVec()) < rad_point + rad_atom + max_dist){
-      atom_id_list.push_back(node->getAtomId());
-    }
-
-    // continue with both children
-    for (AtomNode* child : {node->getLeftChild(), node->getRightChild()}){
-      listFromTree(atom_id_list, child, pos_point, rad_point, rad_max, max_dist, (dim+1)%3);
-    }
+// assigns the type that isAtom would assign after evaluating atoms with these relations. the relations are
+// applied from the strongest to the weakest, so each rule only has to check the type set before
+void Voxel::applyAtomRelations(const CalcContext& ctx, const char relations){
+  if (relations & mvREL_INSIDE){
+    setType(0b00000011);
+  }
+  else if (readBit(getType(),1)){ // if mixed or inside atom
+    return;
+  }
+  else if (relations & mvREL_PARTIAL){
+    setType(0b10000010);
+  }
+  else if (relations & mvREL_SHELL){
+    setType(ctx.masking_mode? 0b01000000 : 0b00010000);
+  }
+  else if (relations & mvREL_TOUCHING_CORE){
+    const char type = getType();
+    if (readBit(type,4) || readBit(type,6)){return;} // if potential shell (of either probe)
+    setType(ctx.masking_mode? 0b11000000 : 0b10010000);
   }
 }
 
@@ -372,193 +370,116 @@ void Voxel::listFromTree(
 // CAVITY ID //
 ///////////////
 
-struct VoxelLoc{
-  VoxelLoc(const std::array<unsigned,3>& index, const int lvl) : index(index), lvl(lvl) {}
-  std::array<unsigned,3> index;
-  int lvl;
-};
-
-bool Voxel::floodFill(const unsigned char id, const std::array<unsigned,3>& start_index, const int start_lvl){
-  assert(_type == 0b00001001);
-  if(getID() != 0){return false;}
-  setID(id);
-  passIDtoChildren(start_index, start_lvl);
-
-  std::vector<VoxelLoc> flood_stack;
-  flood_stack.push_back(VoxelLoc(start_index, start_lvl));
-
-  std::vector<std::vector<std::array<int,3>>> neighbour_indices = SearchIndex().computeIndices(3);
-  neighbour_indices.erase(neighbour_indices.begin());
-
-  // adds neighbours to the stack, IDs are assigned before adding to the stack
-  while (flood_stack.size() > 0){
-    if (Ctrl::getInstance()->getAbortFlag()){return false;}
-    Ctrl::getInstance()->updateCalculationStatus();
-    VoxelLoc vxl = flood_stack.back();
-    flood_stack.pop_back();
-
-    std::array<unsigned,3> nb_index;
-    for (const auto& shell : neighbour_indices){
-      for (const auto& rel_index : shell){
-
-        nb_index = add(vxl.index, rel_index);
-        if (!s_cell->isInBounds(nb_index,vxl.lvl)){continue;} // skip if index is invalid
-        Voxel& nb_vxl = s_cell->getVxlFromGrid(nb_index,vxl.lvl);
-        if (!nb_vxl.isCore()) {continue;} // skip if neighbour is not core
-
-        if (nb_vxl.hasSubvoxel()){
-          // descend to all subvoxels that border this voxel and add to stack
-          nb_vxl.descend(flood_stack, id, nb_index, vxl.lvl, rel_index);
-        }
-        else {
-          // ascend to highest parent of pure type and add to stack
-          nb_vxl.ascend(flood_stack, id, nb_index, vxl.lvl, vxl.index, rel_index);
-        }
-      }
-    }
-  }
-  return true;
-}
-
-void Voxel::descend(std::vector<VoxelLoc>& stack, const unsigned char id, const std::array<unsigned,3>& index, const int lvl, const std::array<int,3>& nb_relation){
-  if (!isCore()){return;} // return immediatly if voxel isn't and doesn't contain core voxel
+// collects all leaves inside this voxel that contain core and border the voxel, from which the neighbour
+// relation was evaluated. the relation determines which subvoxels face that voxel
+void Voxel::listBorderingCoreLeaves(Space& cell, std::vector<VoxelLoc>& leaves, const std::array<unsigned,3>& index, const int lvl, const std::array<int,3>& nb_relation){
+  if (!isCore()){return;} // return immediately if voxel isn't and doesn't contain core voxel
   if (!hasSubvoxel()){
-    if (getID() == 0){
-      // when reaching a voxel that has no children and is core, set ID and add voxel to stack
-      setID(id);
-      passIDtoChildren(index, lvl);
-      stack.push_back(VoxelLoc(index, lvl));
-    }
+    leaves.push_back(VoxelLoc(index, lvl));
+    return;
   }
-  else {
-    // only loop over those voxels bordering the previous voxel
-    std::array<unsigned,3> sub_index;
-
-    // the subvoxels that need to be added to the flood fill stack are determined by the relation of the previous
-    // voxel and the current voxel. the following block evaluates the relation to determine, which subvoxels to
-    // loop through
-    std::array<std::vector<char>,3> loop_i;
-    for (char dim = 0; dim < 3; ++ dim){
-      if (nb_relation[dim]){
-        loop_i[dim] = {static_cast<char>((nb_relation[dim] > 0)? 0 : 1)};
-      }
-      else {
-        loop_i[dim] = {0,1};
-      }
+  std::array<std::vector<char>,3> loop_i;
+  for (char dim = 0; dim < 3; ++ dim){
+    if (nb_relation[dim]){
+      loop_i[dim] = {static_cast<char>((nb_relation[dim] > 0)? 0 : 1)};
     }
-
-    for (char i : loop_i[0]){
-      sub_index[0] = index[0] * 2 + i;
-      for (char j : loop_i[1]){
-        sub_index[1] = index[1] * 2 + j;
-        for (char k : loop_i[2]){
-          sub_index[2] = index[2] * 2 + k;
-          s_cell->getVxlFromGrid(sub_index, lvl-1).descend(stack, id, sub_index, lvl-1, nb_relation);
-        }
-      }
+    else {
+      loop_i[dim] = {0,1};
     }
   }
-}
-
-void Voxel::ascend(std::vector<VoxelLoc>& stack, const unsigned char id, const std::array<unsigned,3> index, const int lvl, std::array<unsigned,3> prev_index, const std::array<int,3>& nb_relation){
-  // compare index with index of previous voxel
-  // if voxel and previous voxel dont't belong to the same parent and this is not top lvl vxl
-  // then compare types of this voxel and parent voxel
 
-  bool same_vxl = false;
-  for (char dim = 0; dim < 3; ++dim){
-    if (!nb_relation[dim]){
-      same_vxl &= (index[dim]/2 == prev_index[dim]/2);
-    }
-  }
-
-  if (!same_vxl && lvl != s_cell->getMaxDepth()){
-    std::array<unsigned,3> parent_index;
-    for (char i = 0; i < 3; ++i){
-      parent_index[i] = index[i]/2;
-      prev_index[i] = prev_index[i]/2;
-    }
-    // access parent
-    Voxel& parent = s_cell->getVxlFromGrid(parent_index, lvl+1);
-    // if types are the same, then move to parent voxel
-    if (parent.getType() == getType()){
-      parent.ascend(stack, id, parent_index, lvl+1, prev_index, nb_relation);
-      return;
+  std::array<unsigned,3> sub_index;
+  for (char i : loop_i[0]){
+    sub_index[0] = index[0] * 2 + i;
+    for (char j : loop_i[1]){
+      sub_index[1] = index[1] * 2 + j;
+      for (char k : loop_i[2]){
+        sub_index[2] = index[2] * 2 + k;
+        cell.getVxlFromGrid(sub_index, lvl-1).listBorderingCoreLeaves(cell, leaves, sub_index, lvl-1, nb_relation);
+      }
     }
   }
-  if (getID() == 0){
-    setID(id);
-    passIDtoChildren(index, lvl);
-    stack.push_back(VoxelLoc(index, lvl));
-  }
 }
 
 ///////////////////////////////
 // TYPE ASSIGNMENT 2ND ROUND //
 ///////////////////////////////
 
-char Voxel::evalRelationToVoxels(const std::array<unsigned int,3>& index, const unsigned lvl, bool split){
+char Voxel::evalRelationToVoxels(const CalcContext& ctx, const std::array<unsigned int,3>& index, const unsigned lvl, bool split){
   // if voxel (including all subvoxels) have been assigned, then return immediately
-  if (Ctrl::getInstance()->getAbortFlag()){return 0;}
-  if (isAssigned()){return _type;}
+  if (ctx.isAborted()){return 0;}
+  if (isAssigned()){return getType();}
   else if (!hasSubvoxel()){ // vxl has no children
-    split = !searchForCore(index, lvl, split);
+    split = !searchForCore(ctx, index, lvl, split);
   }
   if (hasSubvoxel()) { // vxl has children
-    std::array<unsigned int,3> index_subvxl;
     std::array<char,8> subtypes;
-    char i = 0;
-    for (char x = 0; x < 2; x++){
-      index_subvxl[0] = index[0]*2 + x;
-      for (char y = 0; y < 2; y++){
-        index_subvxl[1] = index[1]*2 + y;
-        for (char z = 0; z < 2; z++){
-          index_subvxl[2] = index[2]*2 + z;
-          subtypes[i] = getSubvoxel(index_subvxl, lvl).evalRelationToVoxels(index_subvxl, lvl-1, split);
-          ++i;
-        }
+    auto evalSubvoxel = [&](const unsigned i){
+      std::array<unsigned int,3> index_subvxl;
+      for (char dim = 0; dim < 3; ++dim){
+        index_subvxl[dim] = index[dim]*2 + ((i >> dim) & 1);
       }
+      subtypes[i] = getSubvoxel(ctx.cell, index_subvxl, lvl).evalRelationToVoxels(ctx, index_subvxl, lvl-1, split);
+    };
+    if (lvl >= s_min_spawn_lvl){
+      ThreadPool::forkJoin(8, evalSubvoxel);
+    }
+    else {
+      for (unsigned i = 0; i < 8; ++i){evalSubvoxel(i);}
     }
     setType(mergeTypes(subtypes));
   }
-  else {passTypeToChildren(index, lvl);}
-  return _type;
+  else {passTypeToChildren(ctx.cell, index, lvl);}
+  return getType();
 }
 
-bool Voxel::searchForCore(const std::array<unsigned int,3>& index, const unsigned lvl, bool split){
+bool Voxel::searchForCore(const CalcContext& ctx, const std::array<unsigned int,3>& index, const unsigned lvl, bool split){
   // the return value of this function is used to determine, whether after splitting this voxel,
   // the subsequent neighbour search should start from 0 or from the safe limit. The use of this
   // return value allows avoiding calling a function to validate voxel coordinates (Space::isInBounds)
   // which, due to the number of times the function would have to be called, saves a lot of computations
   bool next_search_from_0 = false;
-  _type = s_masking_mode? 0 : 0b00000101; // type excluded
-
-  const char shell_type = s_masking_mode? 0b01000001 : 0b00010001;
-  const char bit_pos_core = s_masking_mode? 5 : 3;
-
-  for (unsigned int n = (split? Voxel::s_search_indices.getSafeLim(lvl+1)*4 : 1); n <= Voxel::s_search_indices.getUppLim(lvl); ++n){
+  const char prev_type = getType();
+  setType(ctx.masking_mode? 0 : 0b00000101); // type excluded
+
+  const char shell_type = ctx.masking_mode? 0b01000001 : 0b00010001;
+  const char bit_pos_core = ctx.getCoreBit();
+  // the search index is only ever read, the const cast is needed because its access functions are not const
+  SearchIndex& search_indices = const_cast<SearchIndex&>(ctx.search_indices);
+
+  unsigned long n_start = split? search_indices.getSafeLim(lvl+1)*4 : 1;
+  const unsigned long n_end = search_indices.getUppLim(lvl);
+  // no probe core is closer than the distance from the distance transform engine, or the lower bound from the
+  // core pyramid. if that distance is out of range, there is nothing to search
+  if (!ctx.core_distances.empty()){n_start = std::max<unsigned long>(n_start, ctx.core_distances.getSquaredDist(index, lvl));}
+  else if (!ctx.core_pyramid.empty()){n_start = std::max(n_start, ctx.core_pyramid.lowerBound(index, lvl, n_end));}
+  for (unsigned long n = n_start; n <= n_end; ++n){
     // called very often; keep section inexpensive
-    for (std::array<int,3> coord : Voxel::s_search_indices[n]){
+    for (std::array<int,3> coord : search_indices[n]){
       coord = add(coord,index);
+      // neighbours without core are skipped without accessing the grid
+      if (!ctx.core_pyramid.hasCore({(unsigned)coord[0], (unsigned)coord[1], (unsigned)coord[2]}, lvl)){continue;}
       // if a neighbour voxel containing a probe core is found
-      if (readBit((s_cell->getVxlFromGrid(coord,lvl)).getType(),bit_pos_core)){
-        Voxel& nb_vxl = s_cell->getVxlFromGrid(coord,lvl);
+      Voxel& nb_vxl = ctx.cell.getResolvedVxl(coord,lvl);
+      if (readBit(nb_vxl.getType(),bit_pos_core)){
         // if the neighbour is within a safe distance
-        if (n <= Voxel::s_search_indices.getSafeLim(lvl)){
+        if (n <= search_indices.getSafeLim(lvl)){
           next_search_from_0 = true;
           setType(shell_type);
-          if (!s_masking_mode && nb_vxl.getType() != 0b00001001){
+          if (!ctx.masking_mode && nb_vxl.getType() != 0b00001001){
+            // subvoxels are written before the split becomes visible to threads searching this voxel's neighbours
+            materializeSubvoxels(ctx.cell, index, lvl, prev_type);
             setType(0b10000000);
           }
-          else {
-            // voxel evaluation successful
-            setID(nb_vxl.getID());
-            passIDtoChildren(index, lvl);
+          else if (!ctx.masking_mode){
+            // voxel evaluation successful. the shell belongs to the cavity of the core
+            ctx.cell.setCavityID(index, lvl, ctx.cell.getCavityID({(unsigned)coord[0], (unsigned)coord[1], (unsigned)coord[2]}, lvl));
           }
         }
         // if the neighbour is within a questionable distance
         else {
           next_search_from_0 = false;
+          materializeSubvoxels(ctx.cell, index, lvl, prev_type);
           setType(0b10000000);
         }
         return next_search_from_0;
@@ -572,14 +493,7 @@ bool Voxel::searchForCore(const std::array<unsigned int,3>& index, const unsigne
 // TALLY //
 ///////////
 
-void Voxel::tallyVoxelsOfType(std::map<char,unsigned>& type_tally,
-    std::map<unsigned char,unsigned>& id_core_tally,
-    std::map<unsigned char,unsigned>& id_shell_tally,
-    std::map<unsigned char,std::array<unsigned,3>>& id_min,
-    std::map<unsigned char,std::array<unsigned,3>>& id_max,
-    const std::array<unsigned,3>& index,
-    const int lvl)
-{
+void Voxel::tallyVoxelsOfType(Space& cell, VolumeTally& tally, const std::array<unsigned,3>& index, const int lvl){
   // if voxel is of type "mixed" (i.e. data vector is not empty)
   if(hasSubvoxel()){
     // then total number of voxels is given by tallying all subvoxels
@@ -590,32 +504,50 @@ void Voxel::tallyVoxelsOfType(std::map<char,unsigned>& type_tally,
         sub_index[1] = index[1]*2 + y;
         for(char z = 0; z < 2; ++z){
           sub_index[2] = index[2]*2 + z;
-          getSubvoxel(sub_index, lvl).tallyVoxelsOfType(type_tally, id_core_tally, id_shell_tally, id_min, id_max, sub_index, lvl-1);
+          getSubvoxel(cell, sub_index, lvl).tallyVoxelsOfType(cell, tally, sub_index, lvl-1);
         }
       }
     }
   }
   else {
-    // tally number of bottom level voxels
-    type_tally[getType()] += pow(pow2(lvl),3);
-    if(getType() == 0b00001001){
-      id_core_tally[getID()] += pow(pow2(lvl),3);
-    }
-    else if(getType() == 0b00010001){
-      id_shell_tally[getID()] += pow(pow2(lvl),3);
-    }
-    // localise cavities
+    // tally number of bottom level voxels and localise cavities
     std::array<unsigned,3> min;
     std::array<unsigned,3> max;
     for (char i = 0; i < 3; i++){
-      min[i] = index[i]*pow2(lvl);
-      max[i] = ((index[i]+1)*pow2(lvl))-1;
+      min[i] = index[i] << lvl;
+      max[i] = ((index[i]+1) << lvl) - 1;
     }
-    if (id_min.count(getID()) == 0) {id_min[getID()] = min;}
-    if (id_max.count(getID()) == 0) {id_max[getID()] = max;}
-    for (char i = 0; i < 3; i++){
-      if (id_min[getID()][i] > min[i]) {id_min[getID()][i] = min[i];}
-      if (id_max[getID()][i] < max[i]) {id_max[getID()][i] = max[i];}
+    tally.addVoxels(getType(), cell.getCavityID(index, lvl), double(1ul << (3*lvl)), min, max);
+  }
+}
+
+// like tallyVoxelsOfType, but only counts the bottom level voxels within [start,end). a pure voxel adds its overlap
+// with the box at once, and split voxels are only clipped while they cross the border of the box
+void Voxel::tallyVoxelsInBox(Space& cell, VolumeTally& tally, const std::array<unsigned,3>& index, const int lvl,
+                             const std::array<unsigned,3>& start, const std::array<unsigned,3>& end){
+  std::array<unsigned,3> min;
+  std::array<unsigned,3> max;
+  bool inside = true;
+  double n = 1;
+  for (char i = 0; i < 3; i++){
+    const unsigned first = index[i] << lvl;
+    const unsigned last = ((index[i]+1) << lvl) - 1;
+    if (last < start[i] || first >= end[i]){return;}
+    min[i] = std::max(first, start[i]);
+    max[i] = std::min(last, end[i]-1);
+    inside &= min[i] == first && max[i] == last;
+    n *= max[i] - min[i] + 1;
+  }
+  if (!hasSubvoxel()){
+    tally.addVoxels(getType(), cell.getCavityID(index, lvl), n, min, max);
+  }
+  else if (inside){
+    tallyVoxelsOfType(cell, tally, index, lvl);
+  }
+  else {
+    for (char j = 0; j < 8; ++j){
+      const std::array<unsigned,3> sub_index = {index[0]*2 + (j&1), index[1]*2 + ((j>>1)&1), index[2]*2 + ((j>>2)&1)};
+      getSubvoxel(cell, sub_index, lvl).tallyVoxelsInBox(cell, tally, sub_index, lvl-1, start, end);
     }
   }
 }